@@ -21,25 +21,88 @@
 
 #include <errno.h>
 #include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#ifdef HAVE_WORKING_FORK
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
+#include <ec/ec-config.h>
+
+/* Defining EC_FASTJMP selects a minimal hand-written context save/restore
+ * (on x86-64 and aarch64) in place of sigsetjmp/siglongjmp. Only the
+ * callee-saved registers, the stack pointer and the resume address are saved,
+ * which makes ec_try cheaper and its jump buffer smaller. Like ec_try_nosig
+ * the signal mask is not saved. The whole program must agree on EC_FASTJMP:
+ * A library configured with --enable-fastjmp defines it in ec/ec-config.h.
+ */
+#if defined(EC_FASTJMP) && defined(__ELF__) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+struct ec_fastjmp {
+#if defined(__x86_64__)
+    /* rbx, rbp, r12-r15, rsp, and rip. */
+    void *regs[8];
+#else
+    /* x19-x28, x29 (fp), x30 (lr), sp, and d8-d15. */
+    void *regs[21];
 #endif
+};
+typedef struct ec_fastjmp ec_fastjmp_buf[1];
+
+int ec_fastjmp_save(ec_fastjmp_buf env) __attribute__((returns_twice));
+void ec_fastjmp_restore(ec_fastjmp_buf env, int value) __attribute__((noreturn));
 
-#if _POSIX_C_SOURCE >= 1 || _XOPEN_SOURCE || _POSIX_C_SOURCE
+#define ec_jmp_buf ec_fastjmp_buf
+#define ec_setjmp(env) ec_fastjmp_save(env)
+#define ec_setjmp_nosig(env) ec_fastjmp_save(env)
+#define ec_longjmp ec_fastjmp_restore
+#elif _POSIX_C_SOURCE >= 1 || _XOPEN_SOURCE || _POSIX_C_SOURCE
 #define ec_jmp_buf sigjmp_buf
+#ifdef EC_TRY_NOSIG
+#define ec_setjmp(env) sigsetjmp(env, 0)
+#else
 #define ec_setjmp(env) sigsetjmp(env, 1)
+#endif
+#define ec_setjmp_nosig(env) sigsetjmp(env, 0)
 #define ec_longjmp siglongjmp
 #else
 #define ec_jmp_buf jmp_buf
 #define ec_setjmp setjmp
+#define ec_setjmp_nosig setjmp
 #define ec_longjmp longjmp
 #endif
 
+/* Operations used by the block macros. By default these call into the
+ * library. If EC_INLINE is defined before including this header, then static
+ * inline versions operating directly on the error stack (fetched once per
+ * block) are used instead. See ec/static/inline.h.
+ */
+#ifdef EC_INLINE
+#define ec_self_get_() ec_inline_self()
+#define ec_push_env_(s,e) ec_inline_push_env((s), (e))
+#define ec_swap_env_(s,e) ec_inline_swap_env((s), (e))
+#define ec_swap_winding_(s,w) ec_inline_swap_winding((s), (w))
+#define ec_type_get_(s) ec_inline_type((s))
+#define ec_is_a_(s,t) ec_inline_is_a((s), (t))
+#define ec_get_data_(s) ec_inline_get_data((s))
+#define ec_clean_(s) ec_inline_clean((s))
+#define ec_wind_(s,w,d,u) ec_inline_winding_init_and_wind((s), (w), (d), (u))
+#define ec_winding_wind_(s,w) ec_inline_wind((s), (w))
+#define ec_scope_defer_(c,v,u,x) ec_inline_scope_defer((c), (v), (u), (x))
+#define ec_unwind_(s,a) ec_inline_unwind((s), (a))
+#else
+#define ec_self_get_() NULL
+#define ec_push_env_(s,e) ((void)(s), ec_push_env((e)))
+#define ec_swap_env_(s,e) ((void)(s), ec_swap_env((e)))
+#define ec_swap_winding_(s,w) ((void)(s), ec_swap_winding((w)))
+#define ec_type_get_(s) ((void)(s), ec_type(NULL))
+#define ec_is_a_(s,t) ((void)(s), ec_is_a((t)))
+#define ec_get_data_(s) ((void)(s), ec_get_data())
+#define ec_clean_(s) ((void)(s), ec_clean())
+#define ec_wind_(s,w,d,u) ((void)(s), ec_winding_init_and_wind((w), (d), (u)))
+#define ec_winding_wind_(s,w) ((void)(s), ec_winding_wind((w)))
+#define ec_scope_defer_(c,v,u,x) ec_scope_defer((c), (v), (u), (x))
+#define ec_unwind_(s,a) ((void)(s), ec_unwind((a)))
+#endif
+
 /*** Exception Macros
  *
  * These macros are structured similar to the if/else if/else blocks.
@@ -51,6 +114,9 @@
  *     Catch an exception of type t1 and store it's data in d1.
  * }
  * ec_catch_a(t2, d2) { }
+ * ec_catch_desc(t3, d3) {
+ *     Catch an exception of type t3 or any of its subtypes.
+ * }
  * ...
  * ec_catch {
  *     Catch any exception type.
@@ -104,14 +170,19 @@
  *    to use a compiler which supports them. C99 for loops make it possible to
  *    avoid the use of unpleasant begin/end pairs.
  *
- *  - Signal aware sigsetjmp/siglongjmp are used if available (POSIX).
+ *  - Signal aware sigsetjmp/siglongjmp are used if available (POSIX). Saving
+ *    the signal mask costs a system call on every ec_try and every throw. Use
+ *    ec_try_nosig (or define EC_TRY_NOSIG to change the default for ec_try)
+ *    where exceptions are never thrown from signal handlers. Defining
+ *    EC_FASTJMP replaces them with a minimal context save/restore.
  *
  *  - Arguments to macros may be evaluated multiple times (even if the current
  *    version doesn't). Do not pass them statements like 'i++' or any other
  *    statement which would result in a side-effect.
  *
  *  - A coredump is created whenever an exception is thrown if a working
- *    fork() is available (POSIX).
+ *    fork() is available (POSIX). How often this happens is controlled by
+ *    ec_core_policy(...) and ec_core_type(...).
  *
  ***/
 
@@ -120,29 +191,46 @@
  * by one or more ec_catch_a(...) and must end with either an ec_catch or
  * ec_finally.
  */
-#define ec_try \
+#define ec_try ec_try_(ec_setjmp)
+
+/* Like ec_try, but the signal mask is not saved (or restored when an exception
+ * is caught). This avoids a system call on entry and on every throw. Don't use
+ * it where an exception may be thrown from a signal handler: the handler's
+ * signal mask would remain in effect after the catch.
+ */
+#define ec_try_nosig ec_try_(ec_setjmp_nosig)
+
+#define ec_try_(s) \
     /* Setup jump buffer. */ \
     for (ec_jmp_buf ec_env_, \
-         *ec_penv_ = ec_swap_env(&ec_env_), \
+         *ec_penv_ = ec_push_env_(ec_self_get_(), &ec_env_), \
          *ec_try_outer_once_ = NULL; \
          ec_try_outer_once_ == NULL; \
          ec_try_outer_once_ = (void *)1) \
         /* Swap out and save current winding. */ \
-        for (struct ec_winding *ec_pwinding_ = ec_swap_winding(NULL), \
+        for (struct ec_winding *ec_pwinding_ = ec_swap_winding_(ec_self_get_(), NULL), \
              *ec_winding_once_ = NULL; \
              ec_winding_once_ == NULL; \
              ec_winding_once_ = (void *)1) \
+        /* The error stack for the rest of the block. It is declared last */ \
+        /* since GCC warns that the saved environment and winding are used */ \
+        /* uninitialized when they are declared in a loop inside this one */ \
+        /* (the compiler computes the address once either way). */ \
+        for (struct ec *ec_self_ = ec_self_get_(), \
+             **ec_self_once_ = NULL; \
+             ec_self_once_ == NULL; \
+             ec_self_once_ = (void *)1) \
             /* Save current location. */ \
             /* This is where we are restored to after a throw. */ \
-            if (ec_setjmp(ec_env_) == 0) { \
+            if (s(ec_env_) == 0) { \
                 /* If an exception is throw, then the increment is not run, */ \
                 /* otherwise the previous exception environment and winding */ \
                 /* are restored. */ \
                 for (int ec_try_inner_once_ = 0; \
                      ec_try_inner_once_ == 0; \
                      ec_try_inner_once_ = 1, \
-                     ec_swap_env(ec_penv_), \
-                     ec_swap_winding(ec_pwinding_)) \
+                     ec_swap_env_(ec_self_, ec_penv_), \
+                     ec_swap_winding_(ec_self_, ec_pwinding_)) \
 
 /* Catches a specific exception type t and assigns the exception data to d.
  * After the block is exited all exception information will be automatically
@@ -151,14 +239,29 @@
  */
 #define ec_catch_a(t,d) \
             /* An exception was thrown, catch it here if type matches. */ \
-            } else if ((t) == ec_type(NULL)) { \
-                for (ec_swap_env(ec_penv_), /* Restore prev environment. */ \
-                     ec_swap_winding(ec_pwinding_), /* Restore prev winding. */ \
-                     (d) = ec_get_data(), /* Set data. */ \
+            } else if ((t) == ec_type_get_(ec_self_)) { \
+                for (ec_swap_env_(ec_self_, ec_penv_), /* Restore prev environment. */ \
+                     ec_swap_winding_(ec_self_, ec_pwinding_), /* Restore prev winding. */ \
+                     (d) = ec_get_data_(ec_self_), /* Set data. */ \
                      ec_try_outer_once_ = (void *)2; /* Start catching in 'catcha'. */ \
                      ec_try_outer_once_ == (void *)2; /* Only run the loop once. */ \
                      ec_try_outer_once_ = (void *)1, \
-                     ec_clean()) /* Clean up the exception. */ \
+                     ec_clean_(ec_self_)) /* Clean up the exception. */ \
+
+/* Catches an exception whose type is described by t (a struct ec_type_desc *)
+ * or by any descendant of t and assigns the exception data to d. Otherwise
+ * this is the same as ec_catch_a(...).
+ */
+#define ec_catch_desc(t,d) \
+            /* An exception was thrown, catch it here if it is a t. */ \
+            } else if (ec_is_a_(ec_self_, (t))) { \
+                for (ec_swap_env_(ec_self_, ec_penv_), /* Restore prev environment. */ \
+                     ec_swap_winding_(ec_self_, ec_pwinding_), /* Restore prev winding. */ \
+                     (d) = ec_get_data_(ec_self_), /* Set data. */ \
+                     ec_try_outer_once_ = (void *)2; /* Start catching in 'catchd'. */ \
+                     ec_try_outer_once_ == (void *)2; /* Only run the loop once. */ \
+                     ec_try_outer_once_ = (void *)1, \
+                     ec_clean_(ec_self_)) /* Clean up the exception. */ \
 
 /* Catches any exception type. Similar to ec_catch_a(...), After the block is
  * exited all exception information will be automatically cleaned up (e.g. type
@@ -168,12 +271,12 @@
 #define ec_catch \
             /* An exception was thrown, but not specifically handled. */ \
             } else \
-                for (ec_swap_env(ec_penv_), /* Restore prev environment. */ \
-                     ec_swap_winding(ec_pwinding_), /* Restore prev winding. */ \
+                for (ec_swap_env_(ec_self_, ec_penv_), /* Restore prev environment. */ \
+                     ec_swap_winding_(ec_self_, ec_pwinding_), /* Restore prev winding. */ \
                      ec_try_outer_once_ = (void *)3; /* Start catching in 'catch'. */ \
                      ec_try_outer_once_ == (void *)3; /* Only run the loop once */ \
                      ec_try_outer_once_ = (void *)1, \
-                     ec_clean()) \
+                     ec_clean_(ec_self_)) \
 
 /* ec_finally will be run whether an exception is thrown or not. If an
  * exception was thrown, then after the block is exited all exception
@@ -184,13 +287,13 @@
 #define ec_finally \
             /* An exception was thrown, but not specifically handled. */ \
             } else { \
-                ec_swap_env(ec_penv_); /* Restore prev environment. */ \
-                ec_swap_winding(ec_pwinding_); /* Restore prev winding. */ \
+                ec_swap_env_(ec_self_, ec_penv_); /* Restore prev environment. */ \
+                ec_swap_winding_(ec_self_, ec_pwinding_); /* Restore prev winding. */ \
             } \
             for (int ec_finally_once_ = 0; \
                  ec_finally_once_ == 0; \
                  ec_finally_once_ = 1, \
-                 ec_clean()) \
+                 ec_clean_(ec_self_get_())) \
 
 /* Throw an exception of the given type t with cleanup function c and data
  * print function p. If the exception environment has not been setup (ec_try
@@ -199,33 +302,42 @@
  *
  * Before the jump to the catching code the winding stack is unwound.
  */
-#ifdef HAVE_WORKING_FORK
 #define ec_throw(t,c,p) \
     for (   void *ec_throw_data_ = NULL;; \
             ec_set_error((t), ec_throw_data_, (c), (p)), \
-            ec_set_place(__FILE__, __func__, __LINE__), \
-            ec_unwind(EC_UNWIND_ALL), \
-            ec_env(NULL) == NULL ? \
-                ec_fprint(stderr), \
-                fprintf(stderr, "Error stack empty: Abort!\n"), \
-                ec_clean(), \
-                abort() : \
-                (   fork() == 0 ? abort() : wait(NULL), \
-                    ec_longjmp(*ec_env(NULL), 0))) \
+            ec_throw_raise_()) \
             ec_throw_data_ =
-#else
-#define ec_throw(t,c,p) \
+
+/* Throw an exception described by the type descriptor d. The cleanup function
+ * and data printer are the descriptor's defaults. See struct ec_type_desc.
+ */
+#define ec_throw_desc(d) \
     for (   void *ec_throw_data_ = NULL;; \
-            ec_set_error((t), ec_throw_data_, (c), (p)), \
-            ec_set_place(__FILE__, __func__, __LINE__), \
-            ec_unwind(EC_UNWIND_ALL), \
-            ec_env(NULL) == NULL ? \
-                ec_fprint(stderr), \
-                fprintf(stderr, "Error stack empty: Abort!\n"), \
-                ec_clean(), \
-                abort() : \
-                ec_longjmp(*ec_env(NULL), 0)) \
+            ec_set_error_desc((d), ec_throw_data_), \
+            ec_throw_raise_()) \
             ec_throw_data_ =
+
+/* Records the throw site, unwinds, and jumps to the nearest ec_try (or prints
+ * the exception and aborts if there is none). Used by the ec_throw(...) macros
+ * once the exception has been set.
+ */
+#define ec_throw_raise_() \
+    (   ec_set_place(__FILE__, __func__, __LINE__), \
+        ec_unwind(EC_UNWIND_ALL), \
+        ec_env(NULL) == NULL ? \
+            ec_log_uncaught(), \
+            ec_clean(), \
+            abort() : \
+            (   ec_core_(), \
+                ec_longjmp(*ec_env(NULL), 0))) \
+
+/* Creates a coredump (subject to the core policy) if a working fork() is
+ * available. Used by ec_throw(...).
+ */
+#ifdef HAVE_WORKING_FORK
+#define ec_core_() ec_core_dump()
+#else
+#define ec_core_() ((void)0)
 #endif
 
 /* Utility macro for throwing an exception with a C string as data. */
@@ -238,7 +350,10 @@
     ec_throw((t), NULL, (void (*)(FILE *, void *))ec_fprint_str) (void *)ec_throw_str_static_; \
 } \
 
-/* Utility macro for throwing an exception with a format string as data. */
+/* Utility macro for throwing an exception with a format string as data. The
+ * string is formatted (and allocated) at the throw, see ec_throw_fmt(...) for
+ * a cheaper alternative.
+ */
 #ifdef _GNU_SOURCE
 #define ec_throw_strf(t,d,...) \
 { \
@@ -249,8 +364,34 @@
 }
 #endif /* _GNU_SOURCE */
 
-/* Throws the exception type associated with the given error number. */
-#define ec_throw_errno(e,c) ec_throw(ec_errno_type((e)), (c), (void (*)(FILE *, void *))ec_fprint_errno_str)
+/* Utility macro for throwing an exception with a format string and its
+ * arguments as data. For example:
+ *
+ * ec_throw_fmt(ECX_EINVAL, "Bad record %zu in '%s'.", index, path);
+ *
+ * Unlike ec_throw_strf(...) nothing is allocated or formatted at the throw.
+ * The format and its arguments are captured into per-thread storage (strings
+ * are copied, everything is bounded by EC_FMT_ARGS_MAX) and the text is only
+ * rendered when the exception is printed or ec_fmt_str(...) is called on the
+ * data (a struct ec_fmt *).
+ */
+#define ec_throw_fmt(t,...) \
+    ec_throw((t), \
+             (void (*)(void *))ec_fmt_release, \
+             (void (*)(FILE *, void *))ec_fprint_fmt) \
+        ec_fmt_capture(__VA_ARGS__)
+
+/* Throws the exception type associated with the given error number. The error
+ * number is evaluated (and recorded in the exception, see ec_get_errno()) before
+ * the data, so passing errno directly is safe even if computing the data
+ * changes it.
+ */
+#define ec_throw_errno(e,c) \
+    for (int ec_throw_errno_ = (e);;) \
+    for (   void *ec_throw_data_ = NULL;; \
+            ec_set_error_errno(ec_throw_errno_, ec_throw_data_, (c)), \
+            ec_throw_raise_()) \
+            ec_throw_data_ =
 
 /* Rethrows the current exception if one exists (otherwise does nothing). This
  * is useful in situations where an exception was caught, but only partially
@@ -258,10 +399,10 @@
  */
 #define ec_rethrow \
     if (ec_type(NULL) != NULL) { \
+        ec_stats_rethrow(); \
         if (ec_env(NULL) == NULL) { \
             ec_unwind(EC_UNWIND_ALL); \
-            ec_fprint(stderr); \
-            fprintf(stderr, "Error stack empty: Abort!\n"); \
+            ec_log_uncaught(); \
             abort(); \
         } \
         ec_unwind(EC_UNWIND_ALL); \
@@ -294,11 +435,15 @@
  * }
  */
 #define ec_with(d,u) \
+    for (struct ec *ec_self_ = ec_self_get_(), \
+         **ec_self_once_ = NULL; \
+         ec_self_once_ == NULL; \
+         ec_self_once_ = (void *)1) \
     for (struct ec_winding ec_winding_, \
          *ec_with_once_ = NULL; \
          ec_with_once_ == NULL && \
-         ec_winding_init_and_wind(&ec_winding_, (void **)&(d), (u)); \
-         ec_unwind(EC_UNWIND_ONE), \
+         ec_wind_(ec_self_, &ec_winding_, (void **)&(d), (u)); \
+         ec_unwind_(ec_self_, EC_UNWIND_ONE), \
          ec_with_once_ = (void *)1) \
 
 /* Similar to ec_with, but u is only called if an exception occurs. It is useful
@@ -309,11 +454,146 @@
  * and has lower stack memory usage.
  */
 #define ec_with_on_x(d,u) \
+    for (struct ec *ec_self_ = ec_self_get_(), \
+         **ec_self_once_ = NULL; \
+         ec_self_once_ == NULL; \
+         ec_self_once_ = (void *)1) \
     for (struct ec_winding ec_winding_, \
          *ec_with_once_ = NULL; \
          ec_with_once_ == NULL && \
-         ec_winding_init_and_wind(&ec_winding_, (void **)&(d), (u)); \
-         ec_unwind(EC_UNWIND_DISCARD_ONE), \
+         ec_wind_(ec_self_, &ec_winding_, (void **)&(d), (u)); \
+         ec_unwind_(ec_self_, EC_UNWIND_DISCARD_ONE), \
+         ec_with_once_ = (void *)1) \
+
+/* Winds a built-in winding kind k (see enum ec_winding_kind), setting the
+ * winding fields r and a to v and l. Used by the typed ec_with_*(...) macros
+ * below.
+ */
+#define ec_with_kind_(k,r,v,a,l) \
+    for (struct ec *ec_self_ = ec_self_get_(), \
+         **ec_self_once_ = NULL; \
+         ec_self_once_ == NULL; \
+         ec_self_once_ = (void *)1) \
+    for (struct ec_winding ec_winding_ = { .kind = (k), .r = (v), .a = (l) }, \
+         *ec_with_once_ = NULL; \
+         ec_with_once_ == NULL && \
+         ec_winding_wind_(ec_self_, &ec_winding_); \
+         ec_unwind_(ec_self_, EC_UNWIND_ONE), \
+         ec_with_once_ = (void *)1) \
+
+/* Typed variants of ec_with. Rather than calling an unwind function through a
+ * pointer these select a built-in cleanup which ec_unwind(...) performs
+ * directly. As with ec_with the variable is referenced (not copied), so the
+ * cleanup uses its value at the time the block exits:
+ *
+ * int fd = -1;
+ * ec_with_fd(fd) {
+ *     fd = ecx_open(path, O_RDONLY);
+ *     ...
+ * }
+ *
+ * ec_with_free(p)      free(p) (p is any pointer variable).
+ * ec_with_fd(d)        close(d) if d >= 0 (d is an int variable).
+ * ec_with_file(f)      fclose(f) if f is non-NULL (f is a FILE * variable).
+ * ec_with_mutex(m)     pthread_mutex_unlock(m) (m is a pthread_mutex_t *
+ *                      evaluated once on entry and already locked).
+ * ec_with_munmap(p,n)  munmap(p, n) if p is neither NULL nor MAP_FAILED (p is
+ *                      a pointer variable and n is evaluated once on entry).
+ */
+#define ec_with_free(p) \
+    ec_with_kind_(EC_WINDING_FREE, ref.data, (void **)&(p), arg.length, 0)
+
+#define ec_with_fd(d) \
+    ec_with_kind_(EC_WINDING_CLOSE, ref.fd, &(d), arg.length, 0)
+
+#define ec_with_file(f) \
+    ec_with_kind_(EC_WINDING_FCLOSE, ref.file, &(f), arg.length, 0)
+
+#define ec_with_mutex(m) \
+    ec_with_kind_(EC_WINDING_MUTEX_UNLOCK, ref.mutex, (m), arg.length, 0)
+
+#define ec_with_munmap(p,n) \
+    ec_with_kind_(EC_WINDING_MUNMAP, ref.data, (void **)&(p), arg.length, (n))
+
+/* A block collecting cleanups with ec_defer(...) and ec_defer_on_x(...). The
+ * whole scope is a single winding, so acquiring several resources costs one
+ * wind and unwind rather than one per nested ec_with(...) block:
+ *
+ * ec_scope {
+ *     char *buf = ecx_malloc(size);
+ *     ec_defer(buf, free);
+ *     FILE *f = ecx_fopen(path, "r");
+ *     ec_defer(f, fclose);
+ *     ...
+ * }
+ *
+ * The cleanups are called last deferred first when the block exits (normally
+ * or by an exception). Unlike ec_with(...) the value is copied when deferred.
+ *
+ * At most EC_SCOPE_DEFERS cleanups can be deferred. Deferring another calls
+ * its cleanup and throws ECX_ENOBUFS (so the others are called as well). If a
+ * cleanup throws, the remaining cleanups of the scope are still called (as for
+ * an exit by an exception) and the new exception replaces any existing one,
+ * as with nested ec_with(...) blocks.
+ */
+#define ec_scope \
+    for (struct ec *ec_self_ = ec_self_get_(), \
+         **ec_self_once_ = NULL; \
+         ec_self_once_ == NULL; \
+         ec_self_once_ = (void *)1) \
+    for (struct ec_defers ec_scope_, \
+         *ec_scope_once_ = NULL; \
+         ec_scope_once_ == NULL; \
+         ec_scope_once_ = (void *)1) \
+    for (struct ec_winding ec_winding_ = { .kind = EC_WINDING_SCOPE, .ref.scope = &ec_scope_ }, \
+         *ec_with_once_ = NULL; \
+         ec_with_once_ == NULL && \
+         (ec_scope_.len = 0, ec_scope_.on_x = 0, ec_scope_.ok = 0, \
+          ec_winding_wind_(ec_self_, &ec_winding_)); \
+         ec_scope_.ok = 1, \
+         ec_unwind_(ec_self_, EC_UNWIND_ONE), \
+         ec_with_once_ = (void *)1) \
+
+/* Defers calling u with the value v until the enclosing ec_scope exits. */
+#define ec_defer(v,u) \
+    ec_scope_defer_(&ec_scope_, (v), (void (*)(void *))(u), 0)
+
+/* Similar to ec_defer, but u is only called if the scope exits by an
+ * exception.
+ */
+#define ec_defer_on_x(v,u) \
+    ec_scope_defer_(&ec_scope_, (v), (void (*)(void *))(u), 1)
+
+/* Rewinds the arena a (see struct ec_arena) when the block exits (normally or
+ * by an exception), releasing everything allocated from it in the block with
+ * a single winding:
+ *
+ * ec_with_arena(&arena) {
+ *     char *line = ec_arena_alloc(&arena, 512);
+ *     ...
+ * }
+ */
+#define ec_with_arena(a) ec_with_arena_((a), EC_UNWIND_ONE)
+
+/* Similar to ec_with_arena, but the arena is only rewound if an exception
+ * occurs (what was allocated is kept otherwise).
+ */
+#define ec_with_arena_on_x(a) ec_with_arena_((a), EC_UNWIND_DISCARD_ONE)
+
+#define ec_with_arena_(a,amount) \
+    for (struct ec *ec_self_ = ec_self_get_(), \
+         **ec_self_once_ = NULL; \
+         ec_self_once_ == NULL; \
+         ec_self_once_ = (void *)1) \
+    for (struct ec_arena_mark ec_arena_mark_ = ec_arena_mark((a)), \
+         *ec_arena_once_ = NULL; \
+         ec_arena_once_ == NULL; \
+         ec_arena_once_ = (void *)1) \
+    for (struct ec_winding ec_winding_ = { .kind = EC_WINDING_ARENA, .ref.mark = &ec_arena_mark_ }, \
+         *ec_with_once_ = NULL; \
+         ec_with_once_ == NULL && \
+         ec_winding_wind_(ec_self_, &ec_winding_); \
+         ec_unwind_(ec_self_, (amount)), \
          ec_with_once_ = (void *)1) \
 
 /* Similar to ec_shadow_on_x, but also taking a function s that performs the
@@ -457,22 +737,147 @@ extern const char ECX_ETXTBSY[];
 extern const char ECX_EWOULDBLOCK[];
 extern const char ECX_EXDEV[];
 
+/*** Exception Type Descriptors
+ *
+ * A type descriptor gives an exception type a parent along with a default data
+ * cleanup and printer. ec_catch_desc(...) catches a type and all of its
+ * descendants, so a family of types can be caught with a single clause:
+ *
+ * const char APP_IO[] = "I/O";
+ * struct ec_type_desc app_io = EC_TYPE_DESC(APP_IO, NULL, free, ec_fprint_str);
+ * struct ec_type_desc app_disk = EC_TYPE_DESC(ECX_EIO, &app_io, free, ec_fprint_str);
+ *
+ * ec_try {
+ *     ec_throw_desc(&app_disk) strdup("Disk on fire.");
+ * }
+ * ec_catch_desc(&app_io, e) { }
+ * ec_catch { }
+ *
+ * The type of the descriptor is what ec_type(...) reports, so existing types
+ * (such as ECX_EIO above) remain usable with ec_catch_a(...). Similarly, an
+ * exception thrown by type alone (e.g. ec_throw_str(ECX_EIO)) is caught by a
+ * descriptor for that type, but not by the descriptor's ancestors.
+ *
+ * The ancestors of each descriptor are computed on first use (or by calling
+ * ec_type_desc_init(...)), after which a subtype check is constant-time for
+ * hierarchies up to EC_TYPE_DEPTH_MAX deep.
+ *
+ ***/
+
+#define EC_TYPE_DEPTH_MAX 8
+
+struct ec_type_desc {
+    /* The exception type. */
+    const char *type;
+
+    /* The parent type. May be NULL. */
+    struct ec_type_desc *parent;
+
+    /* Default data cleanup and printer. May be NULL. */
+    void (*data_cleanup)(void *data);
+    void (*data_fprint)(FILE *stream, void *data);
+
+    /* Computed by ec_type_desc_init(...). The depth is 0 until then, the root
+     * of a hierarchy has depth 1. ancestors[i] is the ancestor at depth i + 1
+     * (the last being the descriptor itself).
+     */
+    unsigned int depth;
+    struct ec_type_desc *ancestors[EC_TYPE_DEPTH_MAX];
+};
+
+/* Static initializer for a type descriptor. */
+#define EC_TYPE_DESC(t,p,c,f) { \
+    .type = (t), \
+    .parent = (p), \
+    .data_cleanup = (void (*)(void *))(c), \
+    .data_fprint = (void (*)(FILE *, void *))(f), \
+}
+
+/* Computes the ancestors of the descriptor (and of its parents) if that hasn't
+ * been done yet. Calling this on startup is optional.
+ */
+void ec_type_desc_init(struct ec_type_desc *desc);
+
+/* Returns 1 if desc is base or a descendant of base, otherwise 0. */
+int ec_type_desc_is_a(struct ec_type_desc *desc, struct ec_type_desc *base);
+
 /*** Winding 
  *
  * The winding mechanism is used by the ec_with(...) macros to provide a
  * light-weight exception aware solution to data management (such as cleanup).
  *
+ * By default the windings form a list threaded through the stack frames of
+ * the ec_with(...) blocks. If the library is built with EC_WINDING_ARRAY
+ * (configure --enable-winding-array) they are copied into a growable
+ * per-thread array instead, so winding and unwinding are index bumps and
+ * unwinding on a throw is a linear sweep. Winding throws ECX_ENOMEM if the
+ * array can't be grown. Code using EC_INLINE must agree, which configure
+ * ensures by defining it in ec/ec-config.h.
+ *
  ***/
 
 typedef void (*ec_unwind_f)(void *data);
 
+/* How a winding is unwound. EC_WINDING_CALL calls an unwind function (as
+ * ec_with(...) does), the others are performed directly by ec_unwind(...).
+ */
+enum ec_winding_kind {
+    EC_WINDING_CALL = 0,
+    EC_WINDING_FREE,
+    EC_WINDING_CLOSE,
+    EC_WINDING_FCLOSE,
+    EC_WINDING_MUTEX_UNLOCK,
+    EC_WINDING_MUNMAP,
+
+    /* The cleanups of an ec_scope. */
+    EC_WINDING_SCOPE,
+
+    /* Rewinding an arena (ec_with_arena(...)). */
+    EC_WINDING_ARENA,
+};
+
+/* The number of cleanups an ec_scope can hold. */
+#define EC_SCOPE_DEFERS 16
+
+/* The cleanups deferred in an ec_scope. */
+struct ec_defers {
+    unsigned int len;
+
+    /* Bit i is set if defers[i] is only called on an exception. */
+    unsigned int on_x;
+
+    /* Set when the scope exits normally. */
+    int ok;
+
+    struct {
+        void (*cleanup)(void *value);
+        void *value;
+    } defers[EC_SCOPE_DEFERS];
+};
+
 struct ec_winding {
     struct ec_winding *next;
-    void **data;
-    void (*unwind)();
+    enum ec_winding_kind kind;
+
+    /* The data unwound. Variables are referenced so the value they have when
+     * unwound is used.
+     */
+    union {
+        void **data;    /* EC_WINDING_CALL, _FREE and _MUNMAP. */
+        int *fd;        /* EC_WINDING_CLOSE. */
+        FILE **file;    /* EC_WINDING_FCLOSE. */
+        void *mutex;    /* EC_WINDING_MUTEX_UNLOCK (a pthread_mutex_t *). */
+        struct ec_defers *scope; /* EC_WINDING_SCOPE. */
+        struct ec_arena_mark *mark; /* EC_WINDING_ARENA. */
+    } ref;
+
+    union {
+        void (*unwind)();   /* EC_WINDING_CALL. */
+        size_t length;      /* EC_WINDING_MUNMAP. */
+    } arg;
 };
 
-/* Initializes winding and adds to the winding stack.
+/* Initializes winding (as EC_WINDING_CALL) and adds to the winding stack.
  *
  * Return 1 on success (for use in 'with' macros).
  */
@@ -481,6 +886,88 @@ int ec_winding_init_and_wind(
         void **data,
         void (*unwind)());
 
+/* Adds an initialized winding to the winding stack.
+ *
+ * Return 1 on success (for use in 'with' macros).
+ */
+int ec_winding_wind(struct ec_winding *winding);
+
+/* Adds a cleanup to scope (see ec_defer(...)). If on_x is non-zero the cleanup
+ * is only called on an exception.
+ *
+ * Throws ECX_ENOBUFS (after calling cleanup) if the scope is full.
+ */
+void ec_scope_defer(
+        struct ec_defers *scope,
+        void *value,
+        void (*cleanup)(void *value),
+        int on_x);
+
+/*** Arena
+ *
+ * A bump allocator for short-lived memory. Allocations are carved from blocks
+ * of (at least) block_size bytes and are only released together, by
+ * rewinding the arena to a mark taken earlier. ec_with_arena(...) does so
+ * when its block exits, replacing an ec_with(p, free) per temporary.
+ *
+ * An arena is used by one thread at a time.
+ *
+ ***/
+
+/* Allocations are aligned to this. */
+#define EC_ARENA_ALIGN 16
+
+/* The block size used if 0 is given. */
+#define EC_ARENA_BLOCK_SIZE 4096
+
+struct ec_arena_block {
+    struct ec_arena_block *prev;
+    size_t size;
+    char data[];
+};
+
+struct ec_arena {
+    /* The current block, and where its free space starts and ends. */
+    struct ec_arena_block *block;
+    char *next;
+    char *end;
+
+    /* A block kept from the last rewind for reuse. */
+    struct ec_arena_block *spare;
+
+    size_t block_size;
+};
+
+/* A position in an arena to rewind to. */
+struct ec_arena_mark {
+    struct ec_arena *arena;
+    struct ec_arena_block *block;
+    char *next;
+};
+
+/* Initializer for an empty arena (block_size may be 0). */
+#define EC_ARENA_INITIALIZER(block_size) { NULL, NULL, NULL, NULL, (block_size) }
+
+/* Initializes arena as empty (block_size may be 0). */
+void ec_arena_init(struct ec_arena *arena, size_t block_size);
+
+/* Returns size bytes (aligned to EC_ARENA_ALIGN) from arena.
+ *
+ * Throws ECX_ENOMEM if a new block can't be allocated.
+ */
+void *ec_arena_alloc(struct ec_arena *arena, size_t size);
+
+/* Returns the current position of arena. */
+struct ec_arena_mark ec_arena_mark(struct ec_arena *arena);
+
+/* Releases everything allocated from the arena of mark since mark was taken.
+ * The marks taken since are invalid afterwards.
+ */
+void ec_arena_rewind(struct ec_arena_mark *mark);
+
+/* Frees all the memory of arena (leaving it empty). */
+void ec_arena_release(struct ec_arena *arena);
+
 /*** Error Stack
  *
  * The error stack structure keeps track of the booking necessary to facilitate
@@ -497,11 +984,18 @@ struct ec;
 
 /* Swap:
  *
- * Return current value and replace with provided.
+ * Return current value and replace with provided. With EC_WINDING_ARRAY the
+ * winding returned is only a token for swapping back (and NULL starts an
+ * empty winding stack).
  */
 ec_jmp_buf *ec_swap_env(ec_jmp_buf *env);
 struct ec_winding *ec_swap_winding(struct ec_winding *winding);
 
+/* Same as ec_swap_env(...), but counted as entering an ec_try (see
+ * struct ec_stats).
+ */
+ec_jmp_buf *ec_push_env(ec_jmp_buf *env);
+
 /* Get/Set:
  *
  * Returns the current value of the given field. If the argument is non-NULL,
@@ -510,9 +1004,24 @@ struct ec_winding *ec_swap_winding(struct ec_winding *winding);
 ec_jmp_buf *ec_env(ec_jmp_buf *env);
 const char *ec_type(const char *type);
 
+/* Get the current exception type descriptor (NULL if the exception was thrown
+ * by type alone).
+ */
+struct ec_type_desc *ec_get_desc();
+
+/* Returns 1 if the current exception is of the type described by base or one
+ * of its descendants, otherwise 0.
+ */
+int ec_is_a(struct ec_type_desc *base);
+
 /* Get the current exception data. */
 const void *ec_get_data();
 
+/* Get the error number recorded by ec_throw_errno(...) (0 if the current
+ * exception wasn't thrown with one).
+ */
+int ec_get_errno();
+
 /* Get the current exception file. */
 const char *ec_get_file();
 
@@ -522,14 +1031,56 @@ const char *ec_get_function();
 /* Get the current exception line. */
 unsigned int ec_get_line();
 
-/* Set exception type, data, cleanup, and printer. */
+/* The most exceptions kept as causes of the current exception. */
+#define EC_CAUSES_MAX 4
+
+/* An exception replaced by the current exception. */
+struct ec_cause {
+    const char *type;
+    const void *data;
+    void (*data_fprint)(FILE *stream, void *data);
+    const char *file;
+    const char *function;
+    unsigned int line;
+};
+
+/* Get the number of causes of the current exception: The exceptions that were
+ * in flight when it was thrown (by an unwind action or in a catch block, for
+ * example). At most EC_CAUSES_MAX are kept, see ec_get_causes_dropped().
+ */
+unsigned int ec_get_causes_len();
+
+/* Get cause i of the current exception (0 is the first replaced, so normally
+ * the root cause). Returns 0 if there is no such cause. The data is valid
+ * until the current exception is cleaned up.
+ */
+int ec_get_cause(unsigned int i, struct ec_cause *cause);
+
+/* Get the number of causes of the current exception that were dropped (and
+ * cleaned up immediately) because EC_CAUSES_MAX were already kept.
+ */
+unsigned long ec_get_causes_dropped();
+
+/* Set exception type, data, cleanup, and printer. An exception already in
+ * flight becomes a cause of the new one (see ec_get_cause(...)).
+ */
 void ec_set_error(
         const char *type,
         void *data,
         void (*data_cleanup)(void *data),
         void (*data_fprint)(FILE *stream, void *data));
 
-/* Set exception file, function, and line. */
+/* Set exception type, data, cleanup, and printer from a type descriptor. */
+void ec_set_error_desc(struct ec_type_desc *desc, void *data);
+
+/* Set exception type (from the error number), data, and cleanup. The printer is
+ * ec_fprint_errno_str(...) and the error number is recorded.
+ */
+void ec_set_error_errno(int error, void *data, void (*data_cleanup)(void *data));
+
+/* Set exception file, function, and line. The strings are not copied and
+ * must outlive the exception (ec_throw(...) passes __FILE__ and __func__).
+ */
 void ec_set_place(
         const char *file,
         const char *function,
@@ -559,7 +1110,9 @@ void ec_clean();
  * filename:1234: function: Exception(exception) data\n
  *
  * If the data printer wasn't provided then no data is printed (and the
- * trailing space is omitted).
+ * trailing space is omitted). Each cause (see ec_get_cause(...)) follows, last
+ * replaced first, in the same format after "  Replaced: ", and then the
+ * number dropped (if any) as "  Replaced: 3 more\n".
  */
 void ec_fprint(FILE *stream);
 
@@ -568,8 +1121,11 @@ void ec_fprint(FILE *stream);
  */
 void ec_fprint_str(FILE *stream, char *data);
 
-/* Print the standard errno string from sys_errlist and the provided exception
- * data (which must be a NULL terminated C string) to the stream.
+/* Print the description of the current exception's error number and the
+ * provided exception data (which must be a NULL terminated C string) to the
+ * stream. The error number is the one recorded by ec_throw_errno(...), or the
+ * one matching the exception type, or (failing both) errno. Descriptions come
+ * from a static table, see ec_errno_str(...).
  */
 void ec_fprint_errno_str(FILE *stream, char *data);
 
@@ -578,7 +1134,601 @@ void ec_fprint_errno_str(FILE *stream, char *data);
  */
 void ec_shadow(const char *types[2]);
 
-/* Returns the char * representing the type of the given error number. */
+/* Returns the char * representing the type of the given error number (ECX_EC
+ * if there isn't one).
+ */
 const char *ec_errno_type(int error);
 
+/* Returns the error number represented by the type (0 if there isn't one). The
+ * inverse of ec_errno_type(...).
+ */
+int ec_type_errno(const char *type);
+
+/* Returns the symbolic name of the error number (e.g. "ENOENT"), or NULL if it
+ * isn't one of the standard errors below.
+ */
+const char *ec_errno_name(int error);
+
+/* Returns the (untranslated) description of the error number (e.g. "No such
+ * file or directory"), or NULL if it isn't one of the standard errors below.
+ * Unlike strerror(...) this is constant and doesn't consult the locale.
+ */
+const char *ec_errno_str(int error);
+
+/*** Contexts
+ *
+ * A context holds the exception state of an error stack (the ec_try
+ * environments, the windings, and the current exception) so user-space
+ * threads (fibers, coroutines) sharing a thread can each have their own. A
+ * scheduler switches the state along with the fiber:
+ *
+ * ec_context_switch(current->ec, next->ec);
+ * swapcontext(&current->uc, &next->uc);
+ *
+ * The statistics stay with the thread.
+ *
+ ***/
+
+/* Opaque context structure. */
+struct ec_context;
+
+/* Returns a new, empty context.
+ *
+ * Throws ECX_ENOMEM if it can't be allocated.
+ */
+struct ec_context *ec_context_new();
+
+/* Frees context (which must not be the one in use), including any exception
+ * it holds.
+ */
+void ec_context_free(struct ec_context *context);
+
+/* Saves the exception state of the calling thread in from and replaces it with
+ * the state saved in to (leaving to empty). The state is copied (a few words),
+ * which keeps the error stack at a fixed address for every other operation.
+ */
+void ec_context_switch(struct ec_context *from, struct ec_context *to);
+
+/*** Exception Objects
+ *
+ * A caught exception can be taken out of the error stack as an object and
+ * raised again later, possibly in another thread (for example a worker handing
+ * a failure back to the thread waiting on its result):
+ *
+ * ec_try {
+ *     ...
+ * }
+ * ec_catch {
+ *     job->failure = ec_exception_capture();
+ * }
+ *
+ * ...and in the waiting thread:
+ *
+ * if (job->failure != NULL) ec_exception_rethrow(job->failure);
+ *
+ ***/
+
+/* Opaque exception object. */
+struct ec_exception;
+
+/* Takes the current exception (its type, data, cleanup, printer, place and
+ * causes) out of the error stack, which is left without one. The data is not
+ * copied, except where it is kept per thread (that of ec_throw_fmt(...) and of
+ * faults). Returns NULL if there is no current exception.
+ *
+ * Throws ECX_ENOMEM if the object can't be allocated.
+ */
+struct ec_exception *ec_exception_capture();
+
+/* Makes exception the current exception (replacing any existing one as
+ * ec_throw(...) does) and frees the object. The place is the original one.
+ * Does nothing if exception is NULL.
+ */
+void ec_exception_restore(struct ec_exception *exception);
+
+/* Restores exception (see ec_exception_restore(...)) and rethrows it. If
+ * exception is NULL this is the same as ec_rethrow.
+ */
+#define ec_exception_rethrow(x) \
+    for (ec_exception_restore((x));;) { \
+        ec_rethrow \
+        break; \
+    } \
+
+/* Returns the type of exception. */
+const char *ec_exception_type(const struct ec_exception *exception);
+
+/* Frees exception (cleaning up its data) without raising it. */
+void ec_exception_free(struct ec_exception *exception);
+
+/*** Task Groups
+ *
+ * A pool of worker threads running tasks (a function and its argument). Each
+ * worker has its own queue of tasks and takes from the others when it runs
+ * out. Every task runs in its own ec_try: The first exception thrown by a task
+ * cancels the tasks that haven't started yet and is rethrown by
+ * ec_task_group_wait(...) (with its original place). Later exceptions are
+ * discarded.
+ *
+ * struct ec_task_group *group = ec_task_group_new(0);
+ * for (size_t i = 0; i < jobs_len; i++) {
+ *     ec_task_group_spawn(group, run_job, &jobs[i]);
+ * }
+ * ec_with(group, ec_task_group_free) {
+ *     ec_task_group_wait(group);
+ * }
+ *
+ ***/
+
+/* Opaque task group structure. */
+struct ec_task_group;
+
+/* Returns a new task group with the given number of workers (0 for one per
+ * online processor).
+ *
+ * Throws ECX_ENOMEM, or the exception for the error of pthread_create(...), if
+ * the group can't be started.
+ */
+struct ec_task_group *ec_task_group_new(unsigned int workers);
+
+/* Queues task(arg) to be run by the group. Tasks spawned by a task go to the
+ * queue of the worker running it.
+ *
+ * Throws ECX_ENOMEM if the task can't be queued.
+ */
+void ec_task_group_spawn(
+        struct ec_task_group *group,
+        void (*task)(void *arg),
+        void *arg);
+
+/* Waits for all the tasks spawned so far to finish (or be cancelled) and
+ * returns the first exception thrown by them (NULL if there wasn't one). The
+ * group can then be used again. Must not be called by a task of the group.
+ */
+struct ec_exception *ec_task_group_join(struct ec_task_group *group);
+
+/* Waits as ec_task_group_join(...) and rethrows the first exception thrown by
+ * the tasks, if any.
+ */
+#define ec_task_group_wait(g) \
+    for (struct ec_exception *ec_task_exception_ = ec_task_group_join((g)); \
+         ec_task_exception_ != NULL;) \
+        ec_exception_rethrow(ec_task_exception_) \
+
+/* Waits for the tasks (discarding any exception), stops the workers and frees
+ * group.
+ */
+void ec_task_group_free(struct ec_task_group *group);
+
+/*** Logging
+ *
+ * An asynchronous sink for exception reports. Once ec_log_start(...) is
+ * called, records are copied into a ring owned by the calling thread (no locks
+ * are taken) and a background writer thread drains the rings to the sink's
+ * file descriptor, batching records from many threads into each writev(...).
+ * Records are written whole, and in order for each thread.
+ *
+ * Before the sink is started (and after it is stopped) records are written
+ * straight to stderr.
+ *
+ * The uncaught exception reports of ec_throw(...) and ec_rethrow go through
+ * the sink (and are flushed before the abort).
+ *
+ ***/
+
+/* The size of each thread's ring in bytes. */
+#define EC_LOG_RING_SIZE 16384
+
+/* The longest record in bytes. Longer records are truncated. */
+#define EC_LOG_RECORD_MAX 1024
+
+/* Starts the writer thread, which writes the records to fd (not closed by
+ * ec_log_stop()). Does nothing if the sink is already started.
+ *
+ * Throws the exception for the error of pthread_create(...) if the writer
+ * can't be started.
+ */
+void ec_log_start(int fd);
+
+/* Writes out the records logged so far and stops the writer thread. */
+void ec_log_stop();
+
+/* Blocks until the records logged (by any thread) before the call have been
+ * written.
+ */
+void ec_log_flush();
+
+/* Logs the len bytes of record. If the calling thread's ring is full this
+ * waits for the writer to make room.
+ */
+void ec_log_write(const char *record, size_t len);
+
+/* Logs the current exception as printed by ec_fprint(...). */
+void ec_log_fprint();
+
+/* Logs the current exception as uncaught and waits for it to be written. Used
+ * by ec_throw(...) and ec_rethrow before aborting.
+ */
+void ec_log_uncaught();
+
+/*** Deferred Formatting
+ *
+ * Exception data for ec_throw_fmt(...).
+ *
+ ***/
+
+/* Bytes available for the captured arguments (including copied strings). If
+ * they don't fit the text is cut short at the first argument that didn't and
+ * "..." is appended.
+ */
+#define EC_FMT_ARGS_MAX 256
+
+/* Bytes available for the text rendered by ec_fmt_str(...). */
+#define EC_FMT_TEXT_MAX 256
+
+/* Opaque captured format string and arguments. */
+struct ec_fmt;
+
+/* Capture the format and its arguments. Per-thread storage is used unless it
+ * is all in use (by exceptions that are still in flight), in which case the
+ * capture is allocated. Returns NULL if that allocation fails.
+ *
+ * The format itself is not copied and must outlive the capture (normally it
+ * is a literal). The %n conversion is not supported (its argument is ignored).
+ */
+struct ec_fmt *ec_fmt_capture(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/* Release a capture (the cleanup function for ec_throw_fmt(...)). */
+void ec_fmt_release(struct ec_fmt *fmt);
+
+/* Render the capture into its own storage (at most EC_FMT_TEXT_MAX bytes) and
+ * return it. The text is valid until the capture is released.
+ */
+const char *ec_fmt_str(const struct ec_fmt *fmt);
+
+/* Print the capture to the stream (the printer for ec_throw_fmt(...)). */
+void ec_fprint_fmt(FILE *stream, const struct ec_fmt *fmt);
+
+/*** Core Dumps
+ *
+ * When a working fork() is available ec_throw(...) forks and aborts the child
+ * in order to leave a coredump of the state at the throw site. Forking a large
+ * process is expensive (the page tables are copied) so how often this is done
+ * can be limited. The policy is process wide and is checked before fork() is
+ * called.
+ *
+ * A per-type setting overrides the policy for that type. For example, to only
+ * dump on ECX_EFAULT:
+ *
+ * ec_core_policy(EC_CORE_OFF, 0);
+ * ec_core_type(ECX_EFAULT, 1);
+ *
+ ***/
+
+enum ec_core_policy {
+    /* Dump on every throw (the default). */
+    EC_CORE_ALWAYS  = 0,
+
+    /* Never dump. */
+    EC_CORE_OFF     = 1,
+
+    /* Dump on the first n throws of the process. */
+    EC_CORE_FIRST_N = 2,
+
+    /* Dump on 1 in every n throws (counted per thread). */
+    EC_CORE_SAMPLE  = 3,
+
+    /* Dump at most n times per second. */
+    EC_CORE_RATE    = 4,
+};
+
+/* Set the core policy. The meaning of n depends on the policy (it is ignored
+ * for EC_CORE_ALWAYS and EC_CORE_OFF). Changing the policy resets its
+ * counters.
+ */
+void ec_core_policy(enum ec_core_policy policy, unsigned long n);
+
+/* Override the core policy for the given type: dump is 1 to always dump, 0 to
+ * never dump, and -1 to remove the override.
+ *
+ * Throws ECX_ENOBUFS if too many types have been overridden.
+ */
+void ec_core_type(const char *type, int dump);
+
+/* Returns 1 if a coredump should be created for an exception of the given
+ * type and counts it against the policy, otherwise returns 0.
+ */
+int ec_core_check(const char *type);
+
+/* Creates a coredump for the current exception if ec_core_check(...) agrees
+ * (and a working fork() is available).
+ */
+void ec_core_dump();
+
+/*** Flight Recorder
+ *
+ * A cheaper post-mortem record than a coredump. Once ec_recorder_start(...) is
+ * called every throw appends a fixed size record (the type, place, thread,
+ * time, error number and the start of the data) to a ring in a file mapped by
+ * the throwing thread. Each thread's file is created by its first throw:
+ *
+ * <dir>/ec-<pid>-<tid>.rec
+ *
+ * Appending is a few stores into shared pages (no system calls), and since the
+ * pages belong to the file the records survive the process crashing. The
+ * ec-record tool (in tools/) prints the records of a file as text.
+ *
+ * The record's data is the string for ec_throw_str(...) and friends, the
+ * format string for ec_throw_fmt(...), and otherwise empty.
+ *
+ ***/
+
+/* Records kept in each thread's ring (the oldest are overwritten). */
+#define EC_RECORDER_RECORDS 1024
+
+/* The first bytes of a recorder file. */
+#define EC_RECORDER_MAGIC "ECREC001"
+
+/* The header at the start of a recorder file. */
+struct ec_recorder_header {
+    char magic[8];
+
+    /* sizeof(struct ec_record) and EC_RECORDER_RECORDS when written. */
+    uint32_t record_size;
+    uint32_t records;
+
+    /* The process and thread writing the file. */
+    uint32_t pid;
+    uint32_t tid;
+
+    /* Records appended so far. The newest is at (next - 1) % records. */
+    uint64_t next;
+
+    char reserved[32];
+};
+
+/* A record of a throw. Strings are cut short to fit (the file name keeps its
+ * end), and are NUL terminated.
+ */
+struct ec_record {
+    /* One more than the record's position in the thread's sequence. It is
+     * cleared before the record is written and set last, so a record which
+     * doesn't match its position was cut short (or overwritten).
+     */
+    uint64_t seq;
+
+    /* CLOCK_REALTIME in nanoseconds. */
+    uint64_t time;
+
+    uint32_t tid;
+    int32_t errnum;
+    uint32_t line;
+    uint32_t reserved;
+
+    char type[32];
+    char function[40];
+    char file[48];
+    char data[104];
+};
+
+/* Starts recording the throws of every thread to files in the directory dir
+ * (which must exist). If the recorder was already started, threads move to
+ * new files on their next throw.
+ *
+ * Throws ECX_ENAMETOOLONG if dir is too long.
+ */
+void ec_recorder_start(const char *dir);
+
+/* Stops recording. The files are left in place. */
+void ec_recorder_stop();
+
+/* Appends the current exception to the calling thread's recorder. Called by
+ * ec_throw(...) while the recorder is started. Does nothing if the thread's
+ * file can't be created.
+ */
+void ec_recorder_record();
+
+/*** Faults
+ *
+ * Opt-in translation of hardware faults into exceptions: Once
+ * ec_fault_install() is called, a SIGSEGV, SIGBUS or SIGFPE caused by the
+ * program in a thread with an enclosing ec_try unwinds the windings and jumps
+ * to that ec_try as if ECX_SEGV, ECX_BUS, ECX_FPE or ECX_STACK_OVERFLOW had
+ * been thrown there. The data is a struct ec_fault. Like all exception data it
+ * only lasts until the exception is cleaned up, ec_exception_capture() copies
+ * it.
+ *
+ * Faults in a thread without an ec_try (or while a fault is being handled)
+ * are passed on to the handler that was installed before, and by default
+ * terminate the process as usual.
+ *
+ * The handlers run on an alternate signal stack so that a stack overflow can
+ * be caught. Each thread needs its own: ec_fault_install() sets it up for the
+ * calling thread, other threads call ec_fault_thread_init().
+ *
+ * This is only safe where the interrupted code can be abandoned: The fault
+ * may have happened while a lock was held or in the middle of malloc(...),
+ * and the unwind actions run before the ec_catch is reached. The library's
+ * own hooks keep clear of both: A fault is counted by the statistics but not
+ * sampled by the profiler (ec_profile_start(...)), and the recorder
+ * (ec_recorder_start(...)) only records it if the thread has already opened
+ * its file. It is meant for code such as parsers of untrusted records, where
+ * the alternative is to lose the whole process.
+ *
+ ***/
+
+/* Invalid memory reference (SIGSEGV). */
+extern const char ECX_SEGV[];
+
+/* Bus error (SIGBUS), for example reading a mapping past the end of its
+ * file.
+ */
+extern const char ECX_BUS[];
+
+/* Arithmetic fault (SIGFPE), for example integer division by zero. */
+extern const char ECX_FPE[];
+
+/* A SIGSEGV in the guard area below the thread's stack. */
+extern const char ECX_STACK_OVERFLOW[];
+
+/* The minimum size of each thread's alternate signal stack. The windings run
+ * on it.
+ */
+#define EC_FAULT_STACK_SIZE 65536
+
+/* The data of a fault. */
+struct ec_fault {
+    /* The signal and its si_code (e.g. SEGV_MAPERR). */
+    int signo;
+    int code;
+
+    /* The faulting address (si_addr). */
+    void *addr;
+
+    /* The faulting instruction (NULL if unknown). */
+    void *pc;
+};
+
+/* Installs the fault handlers for the process and sets up the calling
+ * thread's alternate signal stack (see ec_fault_thread_init()).
+ *
+ * Throws the exception for the error of sigaction(...) if the handlers can't
+ * be installed.
+ */
+#define ec_fault_install() ec_fault_install_(ec_fault_jump_)
+
+/* Sets up the calling thread's alternate signal stack (freed when the thread
+ * exits). Does nothing if it was already set up.
+ *
+ * Throws ECX_ENOMEM, or the exception for the error of sigaltstack(...), if it
+ * can't be set up.
+ */
+void ec_fault_thread_init();
+
+/* Restores the handlers that were installed before ec_fault_install(). */
+void ec_fault_uninstall();
+
+/* Print the fault (the printer for the fault types). */
+void ec_fprint_fault(FILE *stream, const struct ec_fault *fault);
+
+/* Used by ec_fault_install(): The handlers jump with the ec_longjmp of the
+ * program (which may differ from the library's, see EC_FASTJMP).
+ */
+void ec_fault_install_(void (*jump)());
+
+/* Used by the handlers: ec_set_place(...) without the profiler sample, and
+ * recording the throw only if the record file is already open.
+ */
+void ec_set_place_fault_(
+        const char *file,
+        const char *function,
+        unsigned int line);
+
+static inline void ec_fault_jump_() __attribute__((noreturn, unused));
+
+static inline void
+ec_fault_jump_()
+{
+    ec_longjmp(*ec_env(NULL), 0);
+}
+
+/*** Statistics
+ *
+ * Every thread counts its throws (by type), catches, rethrows, ec_try entries,
+ * windings (ec_with(...) and friends), and unwind actions run. The counters
+ * live in the thread's error stack and are updated without atomic
+ * read-modify-write operations or locks. ec_stats_snapshot(...) adds up the
+ * counters of every live thread and the totals of the threads which have
+ * exited. A thread is only included once it has entered an ec_try or thrown.
+ *
+ ***/
+
+/* Distinct types counted per thread (and in a snapshot). Throws of any further
+ * types are counted in throws_other.
+ */
+#define EC_STATS_TYPES 16
+
+struct ec_stats_type {
+    const char *type;
+    unsigned long long throws;
+};
+
+struct ec_stats {
+    unsigned long long throws;
+
+    /* Exceptions cleaned up after a catch (or finally) block. A rethrow from
+     * the block isn't a catch.
+     */
+    unsigned long long catches;
+    unsigned long long rethrows;
+
+    /* Entries to ec_try (or ec_try_nosig) blocks. */
+    unsigned long long tries;
+
+    /* ec_with(...) and ec_with_on_x(...) entries, and unwind actions run. */
+    unsigned long long windings;
+    unsigned long long unwinds;
+
+    /* Throws by type. In a snapshot these are sorted by throws (most first). */
+    unsigned long long throws_other;
+    size_t types_len;
+    struct ec_stats_type types[EC_STATS_TYPES];
+};
+
+/* Fill stats with the counters of every thread since the start of the
+ * process. The counters of threads that are running are read while they may
+ * still be changing, so the snapshot isn't necessarily consistent between
+ * threads.
+ */
+void ec_stats_snapshot(struct ec_stats *stats);
+
+/* Print the statistics to the stream. */
+void ec_stats_fprint(FILE *stream, const struct ec_stats *stats);
+
+/* Counts a rethrow. Used by ec_rethrow. */
+void ec_stats_rethrow();
+
+/*** Profiling
+ *
+ * A sampling profiler for throws. While it is running 1 in every n throws (per
+ * thread) records the stack of the throw along with the exception type and the
+ * throw site. The samples are dumped as folded stacks (one line per distinct
+ * stack, frames from the outermost in, followed by the sample count) which
+ * flame graph tools read directly:
+ *
+ * main;serve;parse_request;Exception(EINVAL) parse.c:123 42
+ *
+ * Frames are named with dladdr(3), so symbols in the executable are only
+ * found if it was linked with -rdynamic.
+ *
+ ***/
+
+/* Stacks are cut to the innermost frames. */
+#define EC_PROFILE_DEPTH 32
+
+/* Distinct stacks recorded. Samples with a new stack are dropped (and counted
+ * as such) once most of these are in use.
+ */
+#define EC_PROFILE_ENTRIES 4096
+
+/* Start (or continue) sampling 1 in every n throws.
+ *
+ * Throws ECX_ENOMEM if the sample table can't be allocated.
+ */
+void ec_profile_start(unsigned long n);
+
+/* Stop sampling. The samples are kept until ec_profile_reset(). */
+void ec_profile_stop();
+
+/* Discard the samples. */
+void ec_profile_reset();
+
+/* Print the samples to the stream as folded stacks. */
+void ec_profile_dump(FILE *stream);
+
+#ifdef EC_INLINE
+#include <ec/static/inline.h>
+#endif
+
 #endif /* EC_H */
@@ -43,7 +43,18 @@ struct ec {
     /* Data which needs to be unwound on an exception. */
     struct ec_winding *winding;
 
-    struct {
+    /* When built with EC_WINDING_ARRAY the windings are copied into this
+     * growable array instead (and winding above is unused). The windings of
+     * the innermost ec_try start at base.
+     */
+    struct ec_windings {
+        struct ec_winding *slots;
+        size_t len;
+        size_t cap;
+        size_t base;
+    } windings;
+
+    struct ec_error {
         /* Exception type.
          *
          * Any pointer provided here is not expected to be free()'d or modified.
@@ -56,6 +67,11 @@ struct ec {
          */
         const char *type;
 
+        /* Type descriptor if the exception was thrown with one (otherwise
+         * NULL). When non-NULL its type is the same as type above.
+         */
+        struct ec_type_desc *desc;
+
         /* Exception data as per the exception type. May be NULL. */
         void *data;
 
@@ -68,21 +84,69 @@ struct ec {
 
         /* Data printer. */
         void (*data_fprint)(FILE *stream, void *data);
+
+        /* Error number recorded by ec_throw_errno(...) (otherwise 0). */
+        int errnum;
     } error;
 
-    struct {
+    struct ec_place {
         /* The file in which the exception occurred.
          *
-         * May be NULL. Should be free()'d after handling is complete.
+         * May be NULL. This is borrowed (not copied) and must have static
+         * storage duration (e.g. __FILE__).
          */
-        char *file;
+        const char *file;
 
-        /* The function in which the exception occurred. */
-        char *function;
+        /* The function in which the exception occurred. Borrowed as with
+         * file (e.g. __func__).
+         */
+        const char *function;
 
         /* The line in the file that the exception occurred on. */
         unsigned int line;
     } place;
+
+    /* The exceptions replaced by the current one, in the order they were
+     * replaced (see ec_get_cause(...)). Their data is cleaned up along with
+     * the current exception.
+     */
+    struct ec_causes {
+        struct ec_cause_entry {
+            struct ec_error error;
+            struct ec_place place;
+        } entries[EC_CAUSES_MAX];
+        unsigned int len;
+
+        /* Replaced once entries was full (and cleaned up right away). */
+        unsigned long dropped;
+    } causes;
+
+    struct {
+        /* Counters for this thread. They are only written by this thread, but
+         * are read by others (via ec_stats_snapshot(...)) so individual
+         * stores are atomic (relaxed).
+         */
+        struct ec_stats counts;
+
+        /* Non-zero once this thread is on the list of live threads. */
+        int registered;
+
+        /* Live threads. */
+        struct ec *prev;
+        struct ec *next;
+    } stats;
+};
+
+/* The state of an error stack that is switched by ec_context_switch(...):
+ * Everything except the statistics (which stay with the thread).
+ */
+struct ec_context {
+    ec_jmp_buf *env;
+    struct ec_winding *winding;
+    struct ec_windings windings;
+    struct ec_error error;
+    struct ec_place place;
+    struct ec_causes causes;
 };
 
 #endif /* EC_STATIC_H */
@@ -0,0 +1,407 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EC_STATIC_INLINE_H
+#define EC_STATIC_INLINE_H 1
+
+/* Static inline versions of the operations used by the block macros. These
+ * are used by the macros when EC_INLINE is defined before including ec/ec.h
+ * (and by the library to implement the out-of-line versions).
+ *
+ * Like ec/static/ec.h this is a private header: Everything in here is subject
+ * to change at any time. Code using it must be rebuilt along with the library.
+ */
+
+#include <ec/static/ec.h>
+
+/* Defining EC_TLS_INITIAL_EXEC selects the initial-exec TLS model for the
+ * error stack. This avoids a call to __tls_get_addr on every access, but the
+ * library can then only be loaded at program startup (not with dlopen). It is
+ * defined in ec/ec-config.h by configure --enable-initial-exec-tls.
+ */
+#ifdef EC_TLS_INITIAL_EXEC
+#define EC_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#else
+#define EC_TLS_MODEL
+#endif
+
+/* Global per-thread error stack. */
+extern __thread struct ec ec_stack EC_TLS_MODEL;
+
+/* Grows the winding array of the calling thread (EC_WINDING_ARRAY).
+ *
+ * Throws ECX_ENOMEM if the array can't be grown.
+ */
+void ec_winding_grow();
+
+/* Performs the unwind action of a built-in winding kind. Nothing in winding
+ * is used after a cleanup is called (the cleanups of a scope may wind, and so
+ * move the winding array).
+ */
+void ec_winding_unwind_kind(struct ec_winding *winding);
+
+/* Calls cleanup and throws ECX_ENOBUFS (a full ec_scope). */
+void ec_scope_overflow(void *value, void (*cleanup)(void *value));
+
+/* Adds the calling thread to the live threads (for ec_stats_snapshot(...)) and
+ * returns its counters.
+ */
+struct ec_stats *ec_stats_register();
+
+static inline struct ec *
+ec_inline_self()
+{
+    return &ec_stack;
+}
+
+/* Increment a counter of the calling thread. Only the owning thread writes the
+ * counters, so a plain (relaxed) store is enough for other threads to read
+ * them safely.
+ */
+static inline void
+ec_inline_count(unsigned long long *counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+/* The counters of the calling thread, which is added to the live threads if
+ * it hasn't been already. This is only done on ec_try entry and on throws,
+ * the other counters are updated without the check (a thread which does
+ * neither isn't included in ec_stats_snapshot(...)).
+ */
+static inline struct ec_stats *
+ec_inline_stats(struct ec *ec)
+{
+    /* Returning the counters from the call keeps the common path free of a
+     * second lookup of the error stack.
+     */
+    if (__builtin_expect(ec->stats.registered == 0, 0)) {
+        return ec_stats_register();
+    }
+    return &ec->stats.counts;
+}
+
+static inline ec_jmp_buf *
+ec_inline_swap_env(struct ec *ec, ec_jmp_buf *env)
+{
+    ec_jmp_buf *previous = ec->env;
+    ec->env = env;
+    return previous;
+}
+
+static inline ec_jmp_buf *
+ec_inline_push_env(struct ec *ec, ec_jmp_buf *env)
+{
+    ec_jmp_buf *previous = ec_inline_swap_env(ec, env);
+    ec_inline_count(&ec_inline_stats(ec)->tries);
+    return previous;
+}
+
+#ifdef EC_WINDING_ARRAY
+/* The winding "stack" handed out is the base of an ec_try's windings in the
+ * array (plus one, so it is never NULL). Swapping in NULL starts an empty
+ * stack above the current windings.
+ */
+static inline struct ec_winding *
+ec_inline_swap_winding(struct ec *ec, struct ec_winding *winding)
+{
+    struct ec_winding *previous = (struct ec_winding *)(ec->windings.base + 1);
+    ec->windings.base = winding == NULL ?
+        ec->windings.len : (size_t)winding - 1;
+    return previous;
+}
+#else
+static inline struct ec_winding *
+ec_inline_swap_winding(struct ec *ec, struct ec_winding *winding)
+{
+    struct ec_winding *previous = ec->winding;
+    ec->winding = winding;
+    return previous;
+}
+#endif
+
+static inline const char *
+ec_inline_type(struct ec *ec)
+{
+    return ec->error.type;
+}
+
+static inline int
+ec_inline_type_desc_is_a(struct ec_type_desc *desc, struct ec_type_desc *base)
+{
+    unsigned int depth = __atomic_load_n(&base->depth, __ATOMIC_ACQUIRE);
+
+    /* Uninitialized or too deep for the ancestor table. */
+    if (depth == 0 || depth > EC_TYPE_DEPTH_MAX) {
+        return ec_type_desc_is_a(desc, base);
+    }
+
+    return __atomic_load_n(&desc->depth, __ATOMIC_ACQUIRE) >= depth &&
+           desc->ancestors[depth - 1] == base;
+}
+
+static inline int
+ec_inline_is_a(struct ec *ec, struct ec_type_desc *base)
+{
+    if (ec->error.desc == NULL) {
+        return ec->error.type != NULL && ec->error.type == base->type;
+    }
+
+    return ec_inline_type_desc_is_a(ec->error.desc, base);
+}
+
+static inline const void *
+ec_inline_get_data(struct ec *ec)
+{
+    return ec->error.data;
+}
+
+static inline void
+ec_inline_clean(struct ec *ec)
+{
+    /* Only the exception path has anything to clean up. */
+    if (ec->error.type != NULL || ec->error.data_cleanup != NULL) {
+        ec_clean();
+    }
+}
+
+static inline void ec_inline_scope_unwind(
+        struct ec *ec,
+        struct ec_winding *winding);
+
+/* Performs the unwind action of winding. Calls (ec_with(...)), scopes, arenas
+ * and the kinds needing nothing beyond stdlib.h and stdio.h are handled here,
+ * the rest by ec_winding_unwind_kind(...).
+ */
+static inline void
+ec_inline_winding_run(struct ec *ec, struct ec_winding *winding)
+{
+    switch (winding->kind) {
+        case EC_WINDING_CALL:
+            winding->arg.unwind(*(winding->ref.data));
+            break;
+        case EC_WINDING_FREE:
+            free(*(winding->ref.data));
+            break;
+        case EC_WINDING_FCLOSE:
+            if (*(winding->ref.file) != NULL) {
+                fclose(*(winding->ref.file));
+            }
+            break;
+        case EC_WINDING_SCOPE:
+            ec_inline_scope_unwind(ec, winding);
+            break;
+        case EC_WINDING_ARENA:
+            ec_arena_rewind(winding->ref.mark);
+            break;
+        default:
+            ec_winding_unwind_kind(winding);
+            break;
+    }
+}
+
+static inline void
+ec_inline_scope_defer(
+        struct ec_defers *scope,
+        void *value,
+        void (*cleanup)(void *value),
+        int on_x)
+{
+    if (__builtin_expect(scope->len == EC_SCOPE_DEFERS, 0)) {
+        ec_scope_overflow(value, cleanup);
+    }
+
+    /* The bits above len are clear, so only set ones need storing. */
+    scope->on_x |= (unsigned int)(on_x != 0) << scope->len;
+    scope->defers[scope->len].cleanup = cleanup;
+    scope->defers[scope->len].value = value;
+    scope->len++;
+}
+
+#ifdef EC_WINDING_ARRAY
+static inline int
+ec_inline_wind(struct ec *ec, struct ec_winding *winding)
+{
+    if (__builtin_expect(ec->windings.len == ec->windings.cap, 0)) {
+        ec_winding_grow();
+    }
+
+    /* The caller's winding is copied (its next is left unused). Copying by
+     * field lets the compiler store the values directly instead of copying
+     * the freshly initialized winding through wider loads (which stall).
+     */
+    struct ec_winding *slot = &ec->windings.slots[ec->windings.len++];
+    slot->kind = winding->kind;
+    slot->ref = winding->ref;
+    slot->arg = winding->arg;
+
+    ec_inline_count(&ec->stats.counts.windings);
+
+    return 1;
+}
+
+static inline int
+ec_inline_winding_init_and_wind(
+        struct ec *ec,
+        struct ec_winding *winding,
+        void **data,
+        void (*unwind)())
+{
+    if (__builtin_expect(ec->windings.len == ec->windings.cap, 0)) {
+        ec_winding_grow();
+    }
+
+    /* The caller's winding is left unused (as is next here). */
+    (void)winding;
+
+    struct ec_winding *slot = &ec->windings.slots[ec->windings.len++];
+    slot->kind = EC_WINDING_CALL;
+    slot->ref.data = data;
+    slot->arg.unwind = unwind;
+
+    ec_inline_count(&ec->stats.counts.windings);
+
+    return 1;
+}
+
+static inline void
+ec_inline_unwind(struct ec *ec, enum ec_unwind_amount amount)
+{
+    struct ec_winding *head;
+
+    /* As below the winding is removed before its unwind action is called.
+     * The action may wind (and so move the array), so nothing in the array
+     * is used after the call.
+     */
+    switch (amount) {
+        case EC_UNWIND_DISCARD_ONE:
+            ec->windings.len--;
+            break;
+        case EC_UNWIND_ONE:
+            head = &ec->windings.slots[--ec->windings.len];
+            ec_inline_count(&ec->stats.counts.unwinds);
+            ec_inline_winding_run(ec, head);
+            break;
+        case EC_UNWIND_ALL:
+            while (ec->windings.len > ec->windings.base) {
+                head = &ec->windings.slots[--ec->windings.len];
+                ec_inline_count(&ec->stats.counts.unwinds);
+                ec_inline_winding_run(ec, head);
+            }
+            break;
+    }
+}
+#else
+static inline int
+ec_inline_wind(struct ec *ec, struct ec_winding *winding)
+{
+    winding->next = ec->winding;
+    ec->winding = winding;
+
+    ec_inline_count(&ec->stats.counts.windings);
+
+    return 1;
+}
+
+static inline int
+ec_inline_winding_init_and_wind(
+        struct ec *ec,
+        struct ec_winding *winding,
+        void **data,
+        void (*unwind)())
+{
+    winding->kind = EC_WINDING_CALL;
+    winding->ref.data = data;
+    winding->arg.unwind = unwind;
+
+    return ec_inline_wind(ec, winding);
+}
+
+static inline void
+ec_inline_unwind(struct ec *ec, enum ec_unwind_amount amount)
+{
+    struct ec_winding *head = ec->winding;
+
+    /* Its important to remove the winding BEFORE calling the unwind action.
+     * Doing so prevents the unwind action from being called multiple times if
+     * it throws an exception. Note: In event of an exception thrown in an
+     * unwind action the new exception will replace the existing one and
+     * continue calling the remaining unwind actions!
+     */
+    switch (amount) {
+        case EC_UNWIND_DISCARD_ONE:
+            ec->winding = ec->winding->next;
+            break;
+        case EC_UNWIND_ONE:
+            ec->winding = ec->winding->next;
+            ec_inline_count(&ec->stats.counts.unwinds);
+            ec_inline_winding_run(ec, head);
+            break;
+        case EC_UNWIND_ALL:
+            while (head != NULL) {
+                ec->winding = ec->winding->next;
+                ec_inline_count(&ec->stats.counts.unwinds);
+                ec_inline_winding_run(ec, head);
+                head = ec->winding;
+            }
+            break;
+    }
+}
+#endif
+
+/* Calls the cleanups of the scope wound by winding, last deferred first.
+ * Those deferred with ec_defer_on_x(...) are skipped if the scope exited
+ * normally.
+ */
+static inline void
+ec_inline_scope_unwind(struct ec *ec, struct ec_winding *winding)
+{
+    struct ec_defers *scope = winding->ref.scope;
+
+    /* The winding was removed before this was called (and may be a slot of
+     * the winding array, which a cleanup can move), so a copy is kept.
+     */
+    struct ec_winding again = *winding;
+
+    /* Each cleanup is removed before it is called, as with the windings. The
+     * scope is wound again while one is called, so if it throws the unwinding
+     * still calls the remaining ones (with ok cleared, as for an exit by an
+     * exception).
+     */
+    while (scope->len > 0) {
+        unsigned int i = --scope->len;
+
+        if (scope->ok && (scope->on_x >> i) & 1) continue;
+
+        if (scope->len == 0) {
+            scope->defers[i].cleanup(scope->defers[i].value);
+            break;
+        }
+
+        int ok = scope->ok;
+        scope->ok = 0;
+        ec_inline_wind(ec, &again);
+
+        scope->defers[i].cleanup(scope->defers[i].value);
+
+        ec_inline_unwind(ec, EC_UNWIND_DISCARD_ONE);
+        scope->ok = ok;
+    }
+}
+
+#endif /* EC_STATIC_INLINE_H */
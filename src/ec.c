@@ -17,27 +17,90 @@
  */
 
 #include <ec/static/ec.h>
+#include <ec/static/inline.h>
 
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include <sys/types.h>
+
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
+
+#ifdef HAVE_UNWIND_H
+#include <unwind.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_WORKING_FORK
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
 
 /* Global per-thread error stack. */
-__thread struct ec ec_stack = {
+__thread struct ec ec_stack EC_TLS_MODEL = {
     .env = NULL,
     .winding = NULL,
+    .windings = {
+        .slots = NULL,
+        .len = 0,
+        .cap = 0,
+        .base = 0,
+    },
     .error = {
         .type = NULL,
+        .desc = NULL,
         .data = NULL,
         .data_cleanup = NULL,
         .data_fprint = NULL,
+        .errnum = 0,
     },
     .place = {
         .file = NULL,
         .function = NULL,
         .line = 0,
     },
+    .causes = {
+        .len = 0,
+        .dropped = 0,
+    },
+    .stats = {
+        .registered = 0,
+        .prev = NULL,
+        .next = NULL,
+    },
 };
 
+/* The error stack of the calling thread. The compiler treats the address of a
+ * thread local as free to recompute, and does so (with another call to
+ * __tls_get_addr in a shared library) after any call. Hiding where the
+ * pointer came from makes it keep the pointer instead.
+ */
+static inline struct ec *
+ec_self()
+{
+    struct ec *ec = &ec_stack;
+    __asm__("" : "+r" (ec));
+    return ec;
+}
+
 /*** Winding ***/
 
 int
@@ -46,285 +109,2270 @@ ec_winding_init_and_wind(
         void **data,
         void (*unwind)())
 {
-    winding->next = ec_stack.winding;
-    winding->data = data;
-    winding->unwind = unwind;
-
-    ec_stack.winding = winding;
-
-    return 1;
+    return ec_inline_winding_init_and_wind(ec_self(), winding, data, unwind);
 }
 
-/*** Error Stack ***/
+int
+ec_winding_wind(struct ec_winding *winding)
+{
+    return ec_inline_wind(ec_self(), winding);
+}
 
-ec_jmp_buf *
-ec_swap_env(ec_jmp_buf *env)
+void
+ec_winding_unwind_kind(struct ec_winding *winding)
 {
-    ec_jmp_buf *previous = ec_stack.env;
-    ec_stack.env = env;
-    return previous;
+    switch (winding->kind) {
+        case EC_WINDING_CALL:
+            winding->arg.unwind(*(winding->ref.data));
+            break;
+        case EC_WINDING_FREE:
+            free(*(winding->ref.data));
+            break;
+        case EC_WINDING_CLOSE:
+#ifdef HAVE_UNISTD_H
+            if (*(winding->ref.fd) >= 0) {
+                close(*(winding->ref.fd));
+            }
+#endif
+            break;
+        case EC_WINDING_FCLOSE:
+            if (*(winding->ref.file) != NULL) {
+                fclose(*(winding->ref.file));
+            }
+            break;
+        case EC_WINDING_MUTEX_UNLOCK:
+            pthread_mutex_unlock(winding->ref.mutex);
+            break;
+        case EC_WINDING_MUNMAP:
+#ifdef HAVE_SYS_MMAN_H
+            if (*(winding->ref.data) != NULL && *(winding->ref.data) != MAP_FAILED) {
+                munmap(*(winding->ref.data), winding->arg.length);
+            }
+#endif
+            break;
+        case EC_WINDING_SCOPE:
+            ec_inline_scope_unwind(ec_self(), winding);
+            break;
+        case EC_WINDING_ARENA:
+            ec_arena_rewind(winding->ref.mark);
+            break;
+    }
 }
 
-struct ec_winding *
-ec_swap_winding(struct ec_winding *winding)
+void
+ec_scope_defer(
+        struct ec_defers *scope,
+        void *value,
+        void (*cleanup)(void *value),
+        int on_x)
 {
-    struct ec_winding *previous = ec_stack.winding;
-    ec_stack.winding = winding;
-    return previous;
+    ec_inline_scope_defer(scope, value, cleanup, on_x);
 }
 
-ec_jmp_buf *
-ec_env(ec_jmp_buf *env)
+void
+ec_scope_overflow(void *value, void (*cleanup)(void *value))
 {
-    if (env != NULL) ec_stack.env = env;
-    return ec_stack.env;
+    cleanup(value);
+    ec_throw_str_static(ECX_ENOBUFS, "Too many cleanups deferred in the scope.");
 }
 
-const char *
-ec_type(const char *type)
+void
+ec_winding_grow()
 {
-    if (type != NULL) ec_stack.error.type = type;
-    return ec_stack.error.type;
+    size_t cap = ec_stack.windings.cap == 0 ? 32 : ec_stack.windings.cap * 2;
+
+    struct ec_winding *slots = realloc(ec_stack.windings.slots, cap * sizeof(*slots));
+    if (slots == NULL) {
+        ec_throw_str_static(ECX_ENOMEM, "Failed to grow the winding array.");
+    }
+
+    /* The array is freed when the thread exits (along with folding its
+     * statistics).
+     */
+    ec_inline_stats(&ec_stack);
+
+    ec_stack.windings.slots = slots;
+    ec_stack.windings.cap = cap;
 }
 
-const void *
-ec_get_data()
+/*** Arena ***/
+
+void
+ec_arena_init(struct ec_arena *arena, size_t block_size)
 {
-    return ec_stack.error.data;
+    arena->block = NULL;
+    arena->next = NULL;
+    arena->end = NULL;
+    arena->spare = NULL;
+    arena->block_size = block_size;
 }
 
-const char *
-ec_get_file()
+/* Makes a block with at least size bytes the current block of arena. */
+static void
+ec_arena_grow(struct ec_arena *arena, size_t size)
 {
-    return ec_stack.place.file;
+    struct ec_arena_block *block = arena->spare;
+
+    if (block != NULL && block->size >= size) {
+        arena->spare = NULL;
+    }
+    else {
+        size_t block_size = arena->block_size == 0 ?
+            EC_ARENA_BLOCK_SIZE : arena->block_size;
+        if (block_size < size) {
+            block_size = size;
+        }
+
+        if (block_size > SIZE_MAX - sizeof(*block) ||
+            (block = malloc(sizeof(*block) + block_size)) == NULL) {
+            ec_throw_str_static(ECX_ENOMEM, "Failed to grow the arena.");
+        }
+        block->size = block_size;
+    }
+
+    block->prev = arena->block;
+    arena->block = block;
+    arena->next = block->data;
+    arena->end = block->data + block->size;
 }
 
-const char *
-ec_get_function()
+void *
+ec_arena_alloc(struct ec_arena *arena, size_t size)
 {
-    return ec_stack.place.function;
+    if (size > SIZE_MAX - (EC_ARENA_ALIGN - 1)) {
+        ec_throw_str_static(ECX_ENOMEM, "Arena allocation too large.");
+    }
+    size = (size + EC_ARENA_ALIGN - 1) & ~(size_t)(EC_ARENA_ALIGN - 1);
+
+    if (arena->block == NULL || size > (size_t)(arena->end - arena->next)) {
+        ec_arena_grow(arena, size);
+    }
+
+    void *p = arena->next;
+    arena->next += size;
+    return p;
 }
 
-unsigned int
-ec_get_line()
+struct ec_arena_mark
+ec_arena_mark(struct ec_arena *arena)
 {
-    return ec_stack.place.line;
+    return (struct ec_arena_mark){
+        .arena = arena,
+        .block = arena->block,
+        .next = arena->next,
+    };
 }
 
 void
-ec_set_error(
-        const char *type,
-        void *data,
-        void (*data_cleanup)(void *data),
-        void (*data_fprint)(FILE *stream, void *data))
+ec_arena_rewind(struct ec_arena_mark *mark)
 {
-    /* If there is already exception data present
-     * then attempt to print it and cleanup.
+    struct ec_arena *arena = mark->arena;
+
+    /* The largest block released is kept for reuse, which saves a malloc and
+     * free per use of an arena that is rewound to empty.
      */
-    if (ec_stack.error.type != NULL) {
-        /* Print the exception data to stderr. */
-        ec_fprint(stderr);
+    while (arena->block != mark->block) {
+        struct ec_arena_block *block = arena->block;
+        arena->block = block->prev;
 
-        /* Cleanup data. */
-        if (ec_stack.error.data_cleanup != NULL) {
-            ec_stack.error.data_cleanup(ec_stack.error.data);
+        if (arena->spare == NULL || arena->spare->size < block->size) {
+            free(arena->spare);
+            arena->spare = block;
+        }
+        else {
+            free(block);
         }
     }
 
-    ec_stack.error.type = type;
-    ec_stack.error.data = data;
-    ec_stack.error.data_cleanup = data_cleanup;
-    ec_stack.error.data_fprint = data_fprint;
+    arena->next = mark->next;
+    arena->end = arena->block == NULL ?
+        NULL : arena->block->data + arena->block->size;
 }
 
 void
-ec_set_place(
-        const char *file,
-        const char *function,
-        unsigned int line)
+ec_arena_release(struct ec_arena *arena)
 {
-    if (ec_stack.place.file != NULL) free(ec_stack.place.file);
-    ec_stack.place.file = strdup(file);
+    struct ec_arena_mark empty = {
+        .arena = arena,
+        .block = NULL,
+        .next = NULL,
+    };
 
-    if (ec_stack.place.function != NULL) free(ec_stack.place.function);
-    ec_stack.place.function = strdup(function);
+    ec_arena_rewind(&empty);
 
-    ec_stack.place.line = line;
+    free(arena->spare);
+    arena->spare = NULL;
 }
 
+/*** Exception Type Descriptors ***/
+
 void
-ec_unwind(enum ec_unwind_amount amount)
+ec_type_desc_init(struct ec_type_desc *desc)
 {
-    struct ec_winding *head = ec_stack.winding;
+    if (__atomic_load_n(&desc->depth, __ATOMIC_ACQUIRE) != 0) return;
 
-    /* Its important to remove the winding BEFORE calling the unwind action.
-     * Doing so prevents the unwind action from being called multiple times if
-     * it throws an exception. Note: In event of an exception thrown in an
-     * unwind action the new exception will replace the existing one and
-     * continue calling the remaining unwind actions!
+    /* Concurrent initialization is harmless: every thread computes (and
+     * stores) the same values before publishing the depth.
      */
-    switch (amount) {
-        case EC_UNWIND_DISCARD_ONE:
-            ec_stack.winding = ec_stack.winding->next;
-            break;
-        case EC_UNWIND_ONE:
-            ec_stack.winding = ec_stack.winding->next;
-            head->unwind(*(head->data));
-            break;
-        case EC_UNWIND_ALL:
-            while (head != NULL) {
-                ec_stack.winding = ec_stack.winding->next;
-                head->unwind(*(head->data));
-                head = ec_stack.winding;
-            }
-            break;
+    unsigned int depth = 1;
+    if (desc->parent != NULL) {
+        ec_type_desc_init(desc->parent);
+        depth = desc->parent->depth + 1;
+
+        for (unsigned int i = 0; i < depth - 1 && i < EC_TYPE_DEPTH_MAX; i++) {
+            desc->ancestors[i] = desc->parent->ancestors[i];
+        }
+    }
+
+    if (depth <= EC_TYPE_DEPTH_MAX) {
+        desc->ancestors[depth - 1] = desc;
+    }
+
+    __atomic_store_n(&desc->depth, depth, __ATOMIC_RELEASE);
+}
+
+int
+ec_type_desc_is_a(struct ec_type_desc *desc, struct ec_type_desc *base)
+{
+    ec_type_desc_init(desc);
+    ec_type_desc_init(base);
+
+    if (base->depth <= EC_TYPE_DEPTH_MAX) {
+        return desc->depth >= base->depth &&
+               desc->ancestors[base->depth - 1] == base;
+    }
+
+    /* Deeper than the ancestor table, walk up instead. */
+    for (; desc != NULL && desc->depth >= base->depth; desc = desc->parent) {
+        if (desc == base) return 1;
+    }
+
+    return 0;
+}
+
+/*** Statistics ***/
+
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;
+    int key_ok;
+
+    /* Protects the following. */
+    pthread_mutex_t lock;
+
+    /* Counters of the threads which have exited. */
+    struct ec_stats total;
+
+    /* Live threads. */
+    struct ec *live;
+} ec_stats = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Add the counters in from to those in to. The counters in from may belong to
+ * a running thread.
+ */
+static void
+ec_stats_add(struct ec_stats *to, const struct ec_stats *from)
+{
+    to->throws += __atomic_load_n(&from->throws, __ATOMIC_RELAXED);
+    to->catches += __atomic_load_n(&from->catches, __ATOMIC_RELAXED);
+    to->rethrows += __atomic_load_n(&from->rethrows, __ATOMIC_RELAXED);
+    to->tries += __atomic_load_n(&from->tries, __ATOMIC_RELAXED);
+    to->windings += __atomic_load_n(&from->windings, __ATOMIC_RELAXED);
+    to->unwinds += __atomic_load_n(&from->unwinds, __ATOMIC_RELAXED);
+    to->throws_other += __atomic_load_n(&from->throws_other, __ATOMIC_RELAXED);
+
+    size_t len = __atomic_load_n(&from->types_len, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < len; i++) {
+        const char *type = __atomic_load_n(&from->types[i].type, __ATOMIC_RELAXED);
+        unsigned long long throws = __atomic_load_n(&from->types[i].throws, __ATOMIC_RELAXED);
+
+        size_t j = 0;
+        while (j < to->types_len && to->types[j].type != type) j++;
+
+        if (j < to->types_len) {
+            to->types[j].throws += throws;
+        }
+        else if (j < EC_STATS_TYPES) {
+            to->types[j].type = type;
+            to->types[j].throws = throws;
+            to->types_len++;
+        }
+        else {
+            to->throws_other += throws;
+        }
+    }
+}
+
+/* Fold the counters of an exiting thread into the total (and release its
+ * winding array).
+ */
+static void
+ec_stats_fold(void *data)
+{
+    struct ec *ec = data;
+
+    pthread_mutex_lock(&ec_stats.lock);
+
+    ec_stats_add(&ec_stats.total, &ec->stats.counts);
+
+    if (ec->stats.prev != NULL) ec->stats.prev->stats.next = ec->stats.next;
+    else ec_stats.live = ec->stats.next;
+    if (ec->stats.next != NULL) ec->stats.next->stats.prev = ec->stats.prev;
+
+    /* Start over in case the thread throws again in a later destructor. */
+    memset(&ec->stats, 0, sizeof(ec->stats));
+
+    pthread_mutex_unlock(&ec_stats.lock);
+
+    free(ec->windings.slots);
+    ec->windings.slots = NULL;
+    ec->windings.len = 0;
+    ec->windings.cap = 0;
+    ec->windings.base = 0;
+}
+
+static void
+ec_stats_key_create()
+{
+    ec_stats.key_ok = pthread_key_create(&ec_stats.key, ec_stats_fold) == 0;
+}
+
+struct ec_stats *
+ec_stats_register()
+{
+    ec_stack.stats.registered = 1;
+
+    pthread_once(&ec_stats.once, ec_stats_key_create);
+
+    /* Without the key the thread couldn't be removed when it exits, so its
+     * counters go uncounted.
+     */
+    if (!ec_stats.key_ok) return &ec_stack.stats.counts;
+
+    pthread_mutex_lock(&ec_stats.lock);
+    ec_stack.stats.prev = NULL;
+    ec_stack.stats.next = ec_stats.live;
+    if (ec_stats.live != NULL) ec_stats.live->stats.prev = &ec_stack;
+    ec_stats.live = &ec_stack;
+    pthread_mutex_unlock(&ec_stats.lock);
+
+    pthread_setspecific(ec_stats.key, &ec_stack);
+
+    return &ec_stack.stats.counts;
+}
+
+/* Count a throw of the current exception. */
+static void
+ec_stats_throw(struct ec *ec)
+{
+    struct ec_stats *stats = ec_inline_stats(ec);
+    const char *type = ec->error.type;
+
+    ec_inline_count(&stats->throws);
+
+    size_t len = stats->types_len;
+    for (size_t i = 0; i < len; i++) {
+        if (stats->types[i].type == type) {
+            ec_inline_count(&stats->types[i].throws);
+            return;
+        }
+    }
+
+    if (len < EC_STATS_TYPES) {
+        __atomic_store_n(&stats->types[len].throws, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->types[len].type, type, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->types_len, len + 1, __ATOMIC_RELEASE);
+        return;
     }
+
+    ec_inline_count(&stats->throws_other);
 }
 
 void
-ec_clean()
+ec_stats_rethrow()
 {
-    if (ec_stack.error.data_cleanup != NULL) {
-        ec_stack.error.data_cleanup(ec_stack.error.data);
+    ec_inline_count(&ec_inline_stats(&ec_stack)->rethrows);
+}
+
+void
+ec_stats_snapshot(struct ec_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&ec_stats.lock);
+    ec_stats_add(stats, &ec_stats.total);
+    for (struct ec *ec = ec_stats.live; ec != NULL; ec = ec->stats.next) {
+        ec_stats_add(stats, &ec->stats.counts);
     }
-    ec_stack.error.type = NULL;
-    ec_stack.error.data = NULL;
-    ec_stack.error.data_cleanup = NULL;
-    ec_stack.error.data_fprint = NULL;
+    pthread_mutex_unlock(&ec_stats.lock);
 
-    free(ec_stack.place.file);
-    free(ec_stack.place.function);
-    ec_stack.place.file = NULL;
-    ec_stack.place.function = NULL;
-    ec_stack.place.line = 0;
+    /* Most thrown first. */
+    for (size_t i = 1; i < stats->types_len; i++) {
+        struct ec_stats_type type = stats->types[i];
+        size_t j = i;
+        for (; j > 0 && stats->types[j - 1].throws < type.throws; j--) {
+            stats->types[j] = stats->types[j - 1];
+        }
+        stats->types[j] = type;
+    }
 }
 
 void
-ec_fprint(FILE *stream)
+ec_stats_fprint(FILE *stream, const struct ec_stats *stats)
 {
     fprintf(stream,
-            "%s:%u: %s: Exception(%s)",
-            ec_stack.place.file,
-            ec_stack.place.line,
-            ec_stack.place.function,
-            ec_stack.error.type);
+            "throws: %llu catches: %llu rethrows: %llu tries: %llu "
+            "windings: %llu unwinds: %llu\n",
+            stats->throws,
+            stats->catches,
+            stats->rethrows,
+            stats->tries,
+            stats->windings,
+            stats->unwinds);
 
-    if (ec_stack.error.data_fprint != NULL) {
-        fprintf(stream, " ");
-        ec_stack.error.data_fprint(stream, ec_stack.error.data);
+    for (size_t i = 0; i < stats->types_len; i++) {
+        fprintf(stream, "  %s: %llu\n",
+                stats->types[i].type != NULL ? stats->types[i].type : "(null)",
+                stats->types[i].throws);
     }
 
-    fprintf(stream, "\n");
+    if (stats->throws_other != 0) {
+        fprintf(stream, "  (other): %llu\n", stats->throws_other);
+    }
 }
 
-void
-ec_fprint_str(FILE *stream, char *data)
+/*** Profiling ***/
+
+/* A distinct stack (with its type and throw site). */
+struct ec_profile_entry {
+    const char *type;
+    const char *file;
+    unsigned int line;
+
+    /* Frames from the innermost out. */
+    unsigned int depth;
+    int truncated;
+    void *pcs[EC_PROFILE_DEPTH];
+
+    uint64_t hash;
+    unsigned long count;
+};
+
+static struct {
+    /* Sample 1 in n throws (0 when stopped). */
+    unsigned long n;
+
+    /* Protects the following. */
+    pthread_mutex_t lock;
+
+    /* EC_PROFILE_ENTRIES entries (open addressing) once started. */
+    struct ec_profile_entry *entries;
+    size_t len;
+    unsigned long dropped;
+} ec_profile = {
+    .n = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Throws since the last sample by this thread. */
+static __thread unsigned long ec_profile_countdown;
+
+#ifdef HAVE_UNWIND_H
+struct ec_profile_trace {
+    /* Frames still to skip (the profiler's own). */
+    unsigned int skip;
+
+    unsigned int depth;
+    int truncated;
+    void **pcs;
+};
+
+static _Unwind_Reason_Code
+ec_profile_frame(struct _Unwind_Context *context, void *arg)
 {
-    fprintf(stream, "%s", data);
+    struct ec_profile_trace *trace = arg;
+
+    if (trace->skip > 0) {
+        trace->skip--;
+        return _URC_NO_REASON;
+    }
+
+    if (trace->depth == EC_PROFILE_DEPTH) {
+        trace->truncated = 1;
+        return _URC_END_OF_STACK;
+    }
+
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0) return _URC_END_OF_STACK;
+
+    trace->pcs[trace->depth++] = (void *)pc;
+    return _URC_NO_REASON;
+}
+#endif
+
+static uint64_t
+ec_profile_hash(const struct ec_profile_entry *entry)
+{
+    /* FNV-1a over the key. */
+    uint64_t hash = UINT64_C(14695981039346656037);
+    uintptr_t words[3] = {
+        (uintptr_t)entry->type,
+        (uintptr_t)entry->file,
+        (uintptr_t)entry->line,
+    };
+
+    for (size_t i = 0; i < 3 + entry->depth; i++) {
+        uintptr_t word = i < 3 ? words[i] : (uintptr_t)entry->pcs[i - 3];
+        for (size_t b = 0; b < sizeof(word); b++) {
+            hash ^= (word >> (b * 8)) & 0xff;
+            hash *= UINT64_C(1099511628211);
+        }
+    }
+
+    return hash;
+}
+
+/* Record the current throw. Called from ec_set_place(...) so the frames of
+ * this and of ec_set_place(...) are skipped.
+ */
+static __attribute__((noinline)) void
+ec_profile_sample(struct ec *ec)
+{
+    struct ec_profile_entry sample = {
+        .type = ec->error.type,
+        .file = ec->place.file,
+        .line = ec->place.line,
+    };
+
+#ifdef HAVE_UNWIND_H
+    struct ec_profile_trace trace = {
+        .skip = 2,
+        .pcs = sample.pcs,
+    };
+    _Unwind_Backtrace(ec_profile_frame, &trace);
+    sample.depth = trace.depth;
+    sample.truncated = trace.truncated;
+#endif
+
+    sample.hash = ec_profile_hash(&sample);
+
+    pthread_mutex_lock(&ec_profile.lock);
+
+    if (ec_profile.entries != NULL) {
+        size_t i = sample.hash & (EC_PROFILE_ENTRIES - 1);
+        struct ec_profile_entry *entry = &ec_profile.entries[i];
+
+        for (; entry->count != 0; entry = &ec_profile.entries[i]) {
+            if (entry->hash == sample.hash &&
+                entry->type == sample.type &&
+                entry->file == sample.file &&
+                entry->line == sample.line &&
+                entry->depth == sample.depth &&
+                memcmp(entry->pcs, sample.pcs, sample.depth * sizeof(void *)) == 0) {
+                break;
+            }
+            i = (i + 1) & (EC_PROFILE_ENTRIES - 1);
+        }
+
+        if (entry->count != 0) {
+            entry->count++;
+        }
+        else if (ec_profile.len < EC_PROFILE_ENTRIES / 4 * 3) {
+            *entry = sample;
+            entry->count = 1;
+            ec_profile.len++;
+        }
+        else {
+            ec_profile.dropped++;
+        }
+    }
+
+    pthread_mutex_unlock(&ec_profile.lock);
 }
 
 void
-ec_fprint_errno_str(FILE *stream, char *data)
+ec_profile_start(unsigned long n)
 {
-    fprintf(stream, "%s", strerror(errno));
-    if (data != NULL) {
-        fprintf(stream, ": %s", data);
+    int failed = 0;
+
+    pthread_mutex_lock(&ec_profile.lock);
+    if (ec_profile.entries == NULL) {
+        ec_profile.entries = calloc(EC_PROFILE_ENTRIES, sizeof(*ec_profile.entries));
+        failed = ec_profile.entries == NULL;
+    }
+    pthread_mutex_unlock(&ec_profile.lock);
+
+    if (failed) {
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate the profile.");
     }
+
+    __atomic_store_n(&ec_profile.n, n == 0 ? 1 : n, __ATOMIC_RELAXED);
 }
 
 void
-ec_shadow(const char *types[2])
+ec_profile_stop()
 {
-    if (ec_type(NULL) == types[0]) {
-        ec_type(types[1]);
+    __atomic_store_n(&ec_profile.n, 0, __ATOMIC_RELAXED);
+}
+
+void
+ec_profile_reset()
+{
+    pthread_mutex_lock(&ec_profile.lock);
+    if (ec_profile.entries != NULL) {
+        memset(ec_profile.entries, 0, EC_PROFILE_ENTRIES * sizeof(*ec_profile.entries));
     }
+    ec_profile.len = 0;
+    ec_profile.dropped = 0;
+    pthread_mutex_unlock(&ec_profile.lock);
 }
 
-const char *
-ec_errno_type(int error) 
-{
-    switch(error) {
-        case E2BIG: return ECX_E2BIG;
-        case EACCES: return ECX_EACCES;
-        case EADDRINUSE: return ECX_EADDRINUSE;
-        case EADDRNOTAVAIL: return ECX_EADDRNOTAVAIL;
-        case EAFNOSUPPORT: return ECX_EAFNOSUPPORT;
-        case EAGAIN: return ECX_EAGAIN;
-        case EALREADY: return ECX_EALREADY;
-        case EBADF: return ECX_EBADF;
-        case EBADMSG: return ECX_EBADMSG;
-        case EBUSY: return ECX_EBUSY;
-        case ECANCELED: return ECX_ECANCELED;
-        case ECHILD: return ECX_ECHILD;
-        case ECONNABORTED: return ECX_ECONNABORTED;
-        case ECONNREFUSED: return ECX_ECONNREFUSED;
-        case ECONNRESET: return ECX_ECONNRESET;
-        case EDEADLK: return ECX_EDEADLK;
-        case EDESTADDRREQ: return ECX_EDESTADDRREQ;
-        case EDOM: return ECX_EDOM;
-        case EDQUOT: return ECX_EDQUOT;
-        case EEXIST: return ECX_EEXIST;
-        case EFAULT: return ECX_EFAULT;
-        case EFBIG: return ECX_EFBIG;
-        case EHOSTUNREACH: return ECX_EHOSTUNREACH;
-        case EIDRM: return ECX_EIDRM;
-        case EILSEQ: return ECX_EILSEQ;
-        case EINPROGRESS: return ECX_EINPROGRESS;
-        case EINTR: return ECX_EINTR;
-        case EINVAL: return ECX_EINVAL;
-        case EIO: return ECX_EIO;
-        case EISCONN: return ECX_EISCONN;
-        case EISDIR: return ECX_EISDIR;
-        case ELOOP: return ECX_ELOOP;
-        case EMFILE: return ECX_EMFILE;
-        case EMLINK: return ECX_EMLINK;
-        case EMSGSIZE: return ECX_EMSGSIZE;
-        case EMULTIHOP: return ECX_EMULTIHOP;
-        case ENAMETOOLONG: return ECX_ENAMETOOLONG;
-        case ENETDOWN: return ECX_ENETDOWN;
-        case ENETRESET: return ECX_ENETRESET;
-        case ENETUNREACH: return ECX_ENETUNREACH;
-        case ENFILE: return ECX_ENFILE;
-        case ENOBUFS: return ECX_ENOBUFS;
-        case ENODATA: return ECX_ENODATA;
-        case ENODEV: return ECX_ENODEV;
-        case ENOENT: return ECX_ENOENT;
-        case ENOEXEC: return ECX_ENOEXEC;
-        case ENOLCK: return ECX_ENOLCK;
-        case ENOLINK: return ECX_ENOLINK;
-        case ENOMEM: return ECX_ENOMEM;
-        case ENOMSG: return ECX_ENOMSG;
-        case ENOPROTOOPT: return ECX_ENOPROTOOPT;
-        case ENOSPC: return ECX_ENOSPC;
-        case ENOSR: return ECX_ENOSR;
-        case ENOSTR: return ECX_ENOSTR;
-        case ENOSYS: return ECX_ENOSYS;
-        case ENOTCONN: return ECX_ENOTCONN;
-        case ENOTDIR: return ECX_ENOTDIR;
-        case ENOTEMPTY: return ECX_ENOTEMPTY;
-        case ENOTSOCK: return ECX_ENOTSOCK;
-        case ENOTSUP: return ECX_ENOTSUP;
-        case ENOTTY: return ECX_ENOTTY;
-        case ENXIO: return ECX_ENXIO;
-        /* case EOPNOTSUPP: return ECX_EOPNOTSUPP; */
-        case EOVERFLOW: return ECX_EOVERFLOW;
-        case EPERM: return ECX_EPERM;
-        case EPIPE: return ECX_EPIPE;
-        case EPROTO: return ECX_EPROTO;
-        case EPROTONOSUPPORT: return ECX_EPROTONOSUPPORT;
-        case EPROTOTYPE: return ECX_EPROTOTYPE;
-        case ERANGE: return ECX_ERANGE;
-        case EROFS: return ECX_EROFS;
-        case ESPIPE: return ECX_ESPIPE;
-        case ESRCH: return ECX_ESRCH;
-        case ESTALE: return ECX_ESTALE;
-        case ETIME: return ECX_ETIME;
-        case ETIMEDOUT: return ECX_ETIMEDOUT;
-        case ETXTBSY: return ECX_ETXTBSY;
-        /* case EWOULDBLOCK: return ECX_EWOULDBLOCK; */
-        case EXDEV: return ECX_EXDEV;
-        default: return ECX_EC;
+/* Print a frame name (semicolons separate frames, so they are replaced). */
+static void
+ec_profile_fputs(FILE *stream, const char *s)
+{
+    for (; *s != '\0'; s++) {
+        fputc(*s == ';' || *s == '\n' ? '_' : *s, stream);
+    }
+}
+
+static void
+ec_profile_fprint_pc(FILE *stream, void *pc)
+{
+#if defined(HAVE_DLFCN_H) && defined(_GNU_SOURCE)
+    Dl_info info;
+
+    /* The return address may be past the end of the calling function. */
+    if (dladdr((char *)pc - 1, &info) != 0) {
+        if (info.dli_sname != NULL) {
+            ec_profile_fputs(stream, info.dli_sname);
+            return;
+        }
+
+        if (info.dli_fname != NULL) {
+            const char *name = strrchr(info.dli_fname, '/');
+            ec_profile_fputs(stream, name != NULL ? name + 1 : info.dli_fname);
+            fprintf(stream, "+0x%lx",
+                    (unsigned long)((char *)pc - (char *)info.dli_fbase));
+            return;
+        }
+    }
+#endif
+
+    fprintf(stream, "%p", pc);
+}
+
+void
+ec_profile_dump(FILE *stream)
+{
+    pthread_mutex_lock(&ec_profile.lock);
+
+    for (size_t i = 0; ec_profile.entries != NULL && i < EC_PROFILE_ENTRIES; i++) {
+        struct ec_profile_entry *entry = &ec_profile.entries[i];
+        if (entry->count == 0) continue;
+
+        if (entry->truncated) fprintf(stream, "[truncated];");
+
+        for (unsigned int f = entry->depth; f > 0; f--) {
+            ec_profile_fprint_pc(stream, entry->pcs[f - 1]);
+            fputc(';', stream);
+        }
+
+        fprintf(stream, "Exception(");
+        ec_profile_fputs(stream, entry->type != NULL ? entry->type : "(null)");
+        fprintf(stream, ") ");
+        ec_profile_fputs(stream, entry->file != NULL ? entry->file : "(null)");
+        fprintf(stream, ":%u %lu\n", entry->line, entry->count);
+    }
+
+    if (ec_profile.dropped != 0) {
+        fprintf(stream, "[dropped] %lu\n", ec_profile.dropped);
+    }
+
+    pthread_mutex_unlock(&ec_profile.lock);
+}
+
+/*** Flight Recorder ***/
+
+static struct {
+    /* Non-zero while started (read on every throw). */
+    int started;
+
+    /* Bumped by every start (and in the child of a fork), so threads know
+     * their files are stale.
+     */
+    unsigned long generation;
+
+    pthread_once_t once;
+    pthread_key_t key;
+    int key_ok;
+
+    /* Protects dir. */
+    pthread_mutex_t lock;
+    char dir[PATH_MAX];
+} ec_recorder = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* The calling thread's file (map is NULL if there is none). */
+static __thread struct {
+    struct ec_recorder_header *map;
+    struct ec_record *records;
+
+    /* The generation the file (or the failure to create it) belongs to. */
+    unsigned long generation;
+} ec_recorder_thread;
+
+/* The size of a recorder file. */
+#define EC_RECORDER_FILE_SIZE \
+    (sizeof(struct ec_recorder_header) + \
+     EC_RECORDER_RECORDS * sizeof(struct ec_record))
+
+static const char *ec_fmt_format(const struct ec_fmt *fmt);
+
+static void
+ec_recorder_unmap(void *map)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (map != NULL) munmap(map, EC_RECORDER_FILE_SIZE);
+#else
+    (void)map;
+#endif
+}
+
+/* The child's throws go to its own files. */
+static void
+ec_recorder_fork_child()
+{
+    ec_recorder.generation++;
+}
+
+static void
+ec_recorder_init()
+{
+    ec_recorder.key_ok = pthread_key_create(&ec_recorder.key, ec_recorder_unmap) == 0;
+    pthread_atfork(NULL, NULL, ec_recorder_fork_child);
+}
+
+void
+ec_recorder_start(const char *dir)
+{
+    pthread_once(&ec_recorder.once, ec_recorder_init);
+
+    /* Room for the file name. */
+    if (strlen(dir) + 64 > sizeof(ec_recorder.dir)) {
+        ec_throw_str_static(ECX_ENAMETOOLONG, "Recorder directory too long.");
+    }
+
+    pthread_mutex_lock(&ec_recorder.lock);
+    strcpy(ec_recorder.dir, dir);
+    __atomic_add_fetch(&ec_recorder.generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ec_recorder.started, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ec_recorder.lock);
+}
+
+void
+ec_recorder_stop()
+{
+    __atomic_store_n(&ec_recorder.started, 0, __ATOMIC_RELEASE);
+}
+
+/* Creates and maps the calling thread's file for the current generation. */
+static void
+ec_recorder_open(unsigned long generation)
+{
+    ec_recorder_unmap(ec_recorder_thread.map);
+    ec_recorder_thread.map = NULL;
+    ec_recorder_thread.records = NULL;
+    ec_recorder_thread.generation = generation;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H) && defined(SYS_gettid)
+    if (!ec_recorder.key_ok) return;
+
+    pid_t pid = getpid();
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    char path[sizeof(ec_recorder.dir) + 64];
+
+    pthread_mutex_lock(&ec_recorder.lock);
+    snprintf(path, sizeof(path), "%s/ec-%ld-%ld.rec",
+            ec_recorder.dir, (long)pid, (long)tid);
+    pthread_mutex_unlock(&ec_recorder.lock);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, EC_RECORDER_FILE_SIZE) == 0) {
+        map = mmap(NULL, EC_RECORDER_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) return;
+
+    struct ec_recorder_header *header = map;
+    memcpy(header->magic, EC_RECORDER_MAGIC, sizeof(header->magic));
+    header->record_size = sizeof(struct ec_record);
+    header->records = EC_RECORDER_RECORDS;
+    header->pid = pid;
+    header->tid = tid;
+    header->next = 0;
+
+    ec_recorder_thread.map = header;
+    ec_recorder_thread.records = (struct ec_record *)(header + 1);
+    pthread_setspecific(ec_recorder.key, header);
+#endif
+}
+
+/* Copies the string src into dst (of size bytes), keeping its start (or its
+ * end if tail).
+ */
+static void
+ec_recorder_copy(char *dst, size_t size, const char *src, int tail)
+{
+    if (src == NULL) {
+        dst[0] = '\0';
+        return;
+    }
+
+    size_t len = strlen(src);
+    if (len >= size) {
+        if (tail) src += len - (size - 1);
+        len = size - 1;
+    }
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+void
+ec_recorder_record()
+{
+    unsigned long generation = __atomic_load_n(&ec_recorder.generation, __ATOMIC_ACQUIRE);
+    if (ec_recorder_thread.generation != generation) {
+        ec_recorder_open(generation);
+    }
+
+    struct ec_recorder_header *header = ec_recorder_thread.map;
+    if (header == NULL) return;
+
+    uint64_t seq = header->next;
+    struct ec_record *record = &ec_recorder_thread.records[seq % EC_RECORDER_RECORDS];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    int errnum = ec_stack.error.errnum;
+    if (errnum == 0) errnum = ec_type_errno(ec_stack.error.type);
+
+    record->tid = header->tid;
+    record->errnum = errnum;
+    record->line = ec_stack.place.line;
+    record->reserved = 0;
+
+    ec_recorder_copy(record->type, sizeof(record->type), ec_stack.error.type, 0);
+    ec_recorder_copy(record->function, sizeof(record->function), ec_stack.place.function, 0);
+    ec_recorder_copy(record->file, sizeof(record->file), ec_stack.place.file, 1);
+
+    const char *data = NULL;
+    void (*data_fprint)(FILE *, void *) = ec_stack.error.data_fprint;
+    if (data_fprint == (void (*)(FILE *, void *))ec_fprint_str ||
+        data_fprint == (void (*)(FILE *, void *))ec_fprint_errno_str) {
+        data = ec_stack.error.data;
+    }
+    else if (data_fprint == (void (*)(FILE *, void *))ec_fprint_fmt &&
+             ec_stack.error.data != NULL) {
+        data = ec_fmt_format(ec_stack.error.data);
+    }
+    ec_recorder_copy(record->data, sizeof(record->data), data, 0);
+
+    /* The file is read once the process is gone, so only the compiler has to
+     * be kept from moving the stores to seq.
+     */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->next, seq + 1, __ATOMIC_RELAXED);
+}
+
+/*** Error Stack ***/
+
+ec_jmp_buf *
+ec_swap_env(ec_jmp_buf *env)
+{
+    return ec_inline_swap_env(ec_self(), env);
+}
+
+struct ec_winding *
+ec_swap_winding(struct ec_winding *winding)
+{
+    return ec_inline_swap_winding(ec_self(), winding);
+}
+
+ec_jmp_buf *
+ec_push_env(ec_jmp_buf *env)
+{
+    return ec_inline_push_env(ec_self(), env);
+}
+
+ec_jmp_buf *
+ec_env(ec_jmp_buf *env)
+{
+    if (env != NULL) ec_stack.env = env;
+    return ec_stack.env;
+}
+
+const char *
+ec_type(const char *type)
+{
+    if (type != NULL && type != ec_stack.error.type) {
+        ec_stack.error.type = type;
+
+        /* The descriptor no longer describes the exception. */
+        ec_stack.error.desc = NULL;
+    }
+    return ec_stack.error.type;
+}
+
+struct ec_type_desc *
+ec_get_desc()
+{
+    return ec_stack.error.desc;
+}
+
+int
+ec_is_a(struct ec_type_desc *base)
+{
+    return ec_inline_is_a(&ec_stack, base);
+}
+
+const void *
+ec_get_data()
+{
+    return ec_stack.error.data;
+}
+
+int
+ec_get_errno()
+{
+    return ec_stack.error.errnum;
+}
+
+const char *
+ec_get_file()
+{
+    return ec_stack.place.file;
+}
+
+const char *
+ec_get_function()
+{
+    return ec_stack.place.function;
+}
+
+unsigned int
+ec_get_line()
+{
+    return ec_stack.place.line;
+}
+
+/* Adds the exception described by error and place to causes, or cleans it up
+ * if causes is full.
+ */
+static void
+ec_causes_add(
+        struct ec_causes *causes,
+        const struct ec_error *error,
+        const struct ec_place *place)
+{
+    if (causes->len < EC_CAUSES_MAX) {
+        causes->entries[causes->len].error = *error;
+        causes->entries[causes->len].place = *place;
+        causes->len++;
+        return;
+    }
+
+    causes->dropped++;
+    if (error->data_cleanup != NULL) {
+        error->data_cleanup(error->data);
+    }
+}
+
+/* Cleans up (and empties) causes. */
+static void
+ec_causes_clean(struct ec_causes *causes)
+{
+    /* Emptied first, in case a cleanup throws. */
+    unsigned int len = causes->len;
+    causes->len = 0;
+    causes->dropped = 0;
+
+    for (unsigned int i = 0; i < len; i++) {
+        struct ec_error *error = &causes->entries[i].error;
+        if (error->data_cleanup != NULL) {
+            error->data_cleanup(error->data);
+        }
+    }
+}
+
+/* Moves the causes in from to to (leaving from empty). Only the entries in
+ * use are copied.
+ */
+static void
+ec_causes_move(struct ec_causes *to, struct ec_causes *from)
+{
+    for (unsigned int i = 0; i < from->len; i++) {
+        to->entries[i] = from->entries[i];
+    }
+    to->len = from->len;
+    to->dropped = from->dropped;
+
+    from->len = 0;
+    from->dropped = 0;
+}
+
+unsigned int
+ec_get_causes_len()
+{
+    return ec_stack.causes.len;
+}
+
+int
+ec_get_cause(unsigned int i, struct ec_cause *cause)
+{
+    if (i >= ec_stack.causes.len) return 0;
+
+    struct ec_cause_entry *entry = &ec_stack.causes.entries[i];
+    cause->type = entry->error.type;
+    cause->data = entry->error.data;
+    cause->data_fprint = entry->error.data_fprint;
+    cause->file = entry->place.file;
+    cause->function = entry->place.function;
+    cause->line = entry->place.line;
+    return 1;
+}
+
+unsigned long
+ec_get_causes_dropped()
+{
+    return ec_stack.causes.dropped;
+}
+
+void
+ec_set_error(
+        const char *type,
+        void *data,
+        void (*data_cleanup)(void *data),
+        void (*data_fprint)(FILE *stream, void *data))
+{
+    /* If there is already an exception present then it becomes a cause of
+     * the new one.
+     */
+    if (ec_stack.error.type != NULL) {
+        ec_causes_add(&ec_stack.causes, &ec_stack.error, &ec_stack.place);
+    }
+
+    ec_stack.error.type = type;
+    ec_stack.error.desc = NULL;
+    ec_stack.error.data = data;
+    ec_stack.error.data_cleanup = data_cleanup;
+    ec_stack.error.data_fprint = data_fprint;
+    ec_stack.error.errnum = 0;
+}
+
+void
+ec_set_error_desc(struct ec_type_desc *desc, void *data)
+{
+    ec_type_desc_init(desc);
+
+    ec_set_error(desc->type, data, desc->data_cleanup, desc->data_fprint);
+    ec_stack.error.desc = desc;
+}
+
+void
+ec_set_error_errno(int error, void *data, void (*data_cleanup)(void *data))
+{
+    ec_set_error(ec_errno_type(error), data, data_cleanup,
+            (void (*)(FILE *, void *))ec_fprint_errno_str);
+    ec_stack.error.errnum = error;
+}
+
+void
+ec_set_place(
+        const char *file,
+        const char *function,
+        unsigned int line)
+{
+    /* These are borrowed (they are expected to be literals such as __FILE__
+     * and __func__) so that throwing never allocates.
+     */
+    ec_stack.place.file = file;
+    ec_stack.place.function = function;
+    ec_stack.place.line = line;
+
+    /* This is called once per throw (by ec_throw(...)). */
+    ec_stats_throw(&ec_stack);
+
+    unsigned long n = __atomic_load_n(&ec_profile.n, __ATOMIC_RELAXED);
+    if (n != 0 && ++ec_profile_countdown >= n) {
+        ec_profile_countdown = 0;
+        ec_profile_sample(&ec_stack);
+    }
+
+    if (__atomic_load_n(&ec_recorder.started, __ATOMIC_RELAXED)) {
+        ec_recorder_record();
+    }
+}
+
+void
+ec_set_place_fault_(
+        const char *file,
+        const char *function,
+        unsigned int line)
+{
+    ec_stack.place.file = file;
+    ec_stack.place.function = function;
+    ec_stack.place.line = line;
+
+    ec_stats_throw(&ec_stack);
+
+    /* Unlike ec_set_place(...) nothing that locks or allocates: There is no
+     * profiler sample, and the throw is only recorded if the thread's record
+     * file is already open.
+     */
+    if (__atomic_load_n(&ec_recorder.started, __ATOMIC_RELAXED) &&
+        ec_recorder_thread.map != NULL &&
+        ec_recorder_thread.generation ==
+            __atomic_load_n(&ec_recorder.generation, __ATOMIC_ACQUIRE)) {
+        ec_recorder_record();
+    }
+}
+
+void
+ec_unwind(enum ec_unwind_amount amount)
+{
+    ec_inline_unwind(ec_self(), amount);
+}
+
+void
+ec_clean()
+{
+    if (ec_stack.error.type != NULL) {
+        ec_inline_count(&ec_stack.stats.counts.catches);
+    }
+
+    if (ec_stack.error.data_cleanup != NULL) {
+        ec_stack.error.data_cleanup(ec_stack.error.data);
+    }
+    ec_stack.error.type = NULL;
+    ec_stack.error.desc = NULL;
+    ec_stack.error.data = NULL;
+    ec_stack.error.data_cleanup = NULL;
+    ec_stack.error.data_fprint = NULL;
+    ec_stack.error.errnum = 0;
+
+    ec_stack.place.file = NULL;
+    ec_stack.place.function = NULL;
+    ec_stack.place.line = 0;
+
+    ec_causes_clean(&ec_stack.causes);
+}
+
+/* Print one exception in the format of ec_fprint(...). */
+static void
+ec_fprint_one(FILE *stream, struct ec_error *error, struct ec_place *place)
+{
+    fprintf(stream,
+            "%s:%u: %s: Exception(%s)",
+            place->file,
+            place->line,
+            place->function,
+            error->type);
+
+    if (error->data_fprint != NULL) {
+        fprintf(stream, " ");
+        error->data_fprint(stream, error->data);
+    }
+
+    fprintf(stream, "\n");
+}
+
+void
+ec_fprint(FILE *stream)
+{
+    ec_fprint_one(stream, &ec_stack.error, &ec_stack.place);
+
+    if (ec_stack.causes.len == 0) return;
+
+    /* The data printers may consult the error stack (for example the error
+     * number), so each cause is made current while it is printed.
+     */
+    struct ec_error error = ec_stack.error;
+    struct ec_place place = ec_stack.place;
+
+    for (unsigned int i = ec_stack.causes.len; i-- > 0;) {
+        struct ec_cause_entry *entry = &ec_stack.causes.entries[i];
+
+        ec_stack.error = entry->error;
+        ec_stack.place = entry->place;
+
+        fprintf(stream, "  Replaced: ");
+        ec_fprint_one(stream, &ec_stack.error, &ec_stack.place);
+    }
+
+    ec_stack.error = error;
+    ec_stack.place = place;
+
+    if (ec_stack.causes.dropped > 0) {
+        fprintf(stream, "  Replaced: %lu more\n", ec_stack.causes.dropped);
+    }
+}
+
+void
+ec_fprint_str(FILE *stream, char *data)
+{
+    fprintf(stream, "%s", data);
+}
+
+void
+ec_fprint_errno_str(FILE *stream, char *data)
+{
+    int error = ec_stack.error.errnum;
+    if (error == 0) error = ec_type_errno(ec_stack.error.type);
+    if (error == 0) error = errno;
+
+    const char *str = ec_errno_str(error);
+    if (str != NULL) {
+        fprintf(stream, "%s", str);
+    }
+    else {
+        fprintf(stream, "Unknown error %d", error);
+    }
+
+    if (data != NULL) {
+        fprintf(stream, ": %s", data);
+    }
+}
+
+void
+ec_shadow(const char *types[2])
+{
+    if (ec_type(NULL) == types[0]) {
+        ec_type(types[1]);
+    }
+}
+
+/* Standard errors indexed by error number. Where two names share a number
+ * (EWOULDBLOCK and EAGAIN, EOPNOTSUPP and ENOTSUP on some systems) the entry
+ * is the first name's.
+ */
+struct ec_errno_entry {
+    const char *type;
+    const char *name;
+    const char *str;
+};
+
+#define EC_ERRNO_(e,s) [e] = { ECX_##e, #e, s }
+
+static const struct ec_errno_entry ec_errno_table[] = {
+    EC_ERRNO_(E2BIG, "Argument list too long"),
+    EC_ERRNO_(EACCES, "Permission denied"),
+    EC_ERRNO_(EADDRINUSE, "Address already in use"),
+    EC_ERRNO_(EADDRNOTAVAIL, "Cannot assign requested address"),
+    EC_ERRNO_(EAFNOSUPPORT, "Address family not supported by protocol"),
+    EC_ERRNO_(EAGAIN, "Resource temporarily unavailable"),
+    EC_ERRNO_(EALREADY, "Operation already in progress"),
+    EC_ERRNO_(EBADF, "Bad file descriptor"),
+    EC_ERRNO_(EBADMSG, "Bad message"),
+    EC_ERRNO_(EBUSY, "Device or resource busy"),
+    EC_ERRNO_(ECANCELED, "Operation canceled"),
+    EC_ERRNO_(ECHILD, "No child processes"),
+    EC_ERRNO_(ECONNABORTED, "Software caused connection abort"),
+    EC_ERRNO_(ECONNREFUSED, "Connection refused"),
+    EC_ERRNO_(ECONNRESET, "Connection reset by peer"),
+    EC_ERRNO_(EDEADLK, "Resource deadlock avoided"),
+    EC_ERRNO_(EDESTADDRREQ, "Destination address required"),
+    EC_ERRNO_(EDOM, "Numerical argument out of domain"),
+    EC_ERRNO_(EDQUOT, "Disk quota exceeded"),
+    EC_ERRNO_(EEXIST, "File exists"),
+    EC_ERRNO_(EFAULT, "Bad address"),
+    EC_ERRNO_(EFBIG, "File too large"),
+    EC_ERRNO_(EHOSTUNREACH, "No route to host"),
+    EC_ERRNO_(EIDRM, "Identifier removed"),
+    EC_ERRNO_(EILSEQ, "Invalid or incomplete multibyte or wide character"),
+    EC_ERRNO_(EINPROGRESS, "Operation now in progress"),
+    EC_ERRNO_(EINTR, "Interrupted system call"),
+    EC_ERRNO_(EINVAL, "Invalid argument"),
+    EC_ERRNO_(EIO, "Input/output error"),
+    EC_ERRNO_(EISCONN, "Transport endpoint is already connected"),
+    EC_ERRNO_(EISDIR, "Is a directory"),
+    EC_ERRNO_(ELOOP, "Too many levels of symbolic links"),
+    EC_ERRNO_(EMFILE, "Too many open files"),
+    EC_ERRNO_(EMLINK, "Too many links"),
+    EC_ERRNO_(EMSGSIZE, "Message too long"),
+    EC_ERRNO_(EMULTIHOP, "Multihop attempted"),
+    EC_ERRNO_(ENAMETOOLONG, "File name too long"),
+    EC_ERRNO_(ENETDOWN, "Network is down"),
+    EC_ERRNO_(ENETRESET, "Network dropped connection on reset"),
+    EC_ERRNO_(ENETUNREACH, "Network is unreachable"),
+    EC_ERRNO_(ENFILE, "Too many open files in system"),
+    EC_ERRNO_(ENOBUFS, "No buffer space available"),
+    EC_ERRNO_(ENODATA, "No data available"),
+    EC_ERRNO_(ENODEV, "No such device"),
+    EC_ERRNO_(ENOENT, "No such file or directory"),
+    EC_ERRNO_(ENOEXEC, "Exec format error"),
+    EC_ERRNO_(ENOLCK, "No locks available"),
+    EC_ERRNO_(ENOLINK, "Link has been severed"),
+    EC_ERRNO_(ENOMEM, "Cannot allocate memory"),
+    EC_ERRNO_(ENOMSG, "No message of desired type"),
+    EC_ERRNO_(ENOPROTOOPT, "Protocol not available"),
+    EC_ERRNO_(ENOSPC, "No space left on device"),
+    EC_ERRNO_(ENOSR, "Out of streams resources"),
+    EC_ERRNO_(ENOSTR, "Device not a stream"),
+    EC_ERRNO_(ENOSYS, "Function not implemented"),
+    EC_ERRNO_(ENOTCONN, "Transport endpoint is not connected"),
+    EC_ERRNO_(ENOTDIR, "Not a directory"),
+    EC_ERRNO_(ENOTEMPTY, "Directory not empty"),
+    EC_ERRNO_(ENOTSOCK, "Socket operation on non-socket"),
+    EC_ERRNO_(ENOTSUP, "Operation not supported"),
+    EC_ERRNO_(ENOTTY, "Inappropriate ioctl for device"),
+    EC_ERRNO_(ENXIO, "No such device or address"),
+#if EOPNOTSUPP != ENOTSUP
+    EC_ERRNO_(EOPNOTSUPP, "Operation not supported on socket"),
+#endif
+    EC_ERRNO_(EOVERFLOW, "Value too large for defined data type"),
+    EC_ERRNO_(EPERM, "Operation not permitted"),
+    EC_ERRNO_(EPIPE, "Broken pipe"),
+    EC_ERRNO_(EPROTO, "Protocol error"),
+    EC_ERRNO_(EPROTONOSUPPORT, "Protocol not supported"),
+    EC_ERRNO_(EPROTOTYPE, "Protocol wrong type for socket"),
+    EC_ERRNO_(ERANGE, "Numerical result out of range"),
+    EC_ERRNO_(EROFS, "Read-only file system"),
+    EC_ERRNO_(ESPIPE, "Illegal seek"),
+    EC_ERRNO_(ESRCH, "No such process"),
+    EC_ERRNO_(ESTALE, "Stale file handle"),
+    EC_ERRNO_(ETIME, "Timer expired"),
+    EC_ERRNO_(ETIMEDOUT, "Connection timed out"),
+    EC_ERRNO_(ETXTBSY, "Text file busy"),
+#if EWOULDBLOCK != EAGAIN
+    EC_ERRNO_(EWOULDBLOCK, "Operation would block"),
+#endif
+    EC_ERRNO_(EXDEV, "Invalid cross-device link"),
+};
+
+#undef EC_ERRNO_
+
+#define EC_ERRNO_LEN (sizeof(ec_errno_table) / sizeof(ec_errno_table[0]))
+
+/* Types which are aliases for another name's error number (and so are absent
+ * from the table above when the numbers are the same).
+ */
+static const struct {
+    const char *type;
+    int error;
+} ec_errno_aliases[] = {
+    {ECX_EWOULDBLOCK, EWOULDBLOCK},
+    {ECX_EOPNOTSUPP, EOPNOTSUPP},
+};
+
+/* Reverse index from type to error number. Open addressing on the type's
+ * address, built on first use. Types are unique pointers so the hash never
+ * needs to compare strings.
+ */
+#define EC_ERRNO_INDEX_BITS 8
+#define EC_ERRNO_INDEX_LEN (1 << EC_ERRNO_INDEX_BITS)
+
+static struct {
+    /* 0 (empty), 1 (being built), 2 (built). */
+    int state;
+
+    struct {
+        const char *type;
+        int error;
+    } slots[EC_ERRNO_INDEX_LEN];
+} ec_errno_index;
+
+static size_t
+ec_errno_hash(const char *type)
+{
+    return (size_t)(((uint64_t)(uintptr_t)type * UINT64_C(0x9E3779B97F4A7C15))
+            >> (64 - EC_ERRNO_INDEX_BITS));
+}
+
+static void
+ec_errno_index_add(const char *type, int error)
+{
+    size_t i = ec_errno_hash(type);
+    while (ec_errno_index.slots[i].type != NULL) {
+        if (ec_errno_index.slots[i].type == type) return;
+        i = (i + 1) & (EC_ERRNO_INDEX_LEN - 1);
+    }
+    ec_errno_index.slots[i].type = type;
+    ec_errno_index.slots[i].error = error;
+}
+
+/* Returns 1 when the index is usable. The thread that gets to build it does
+ * so; any others use the table directly in the meantime.
+ */
+static int
+ec_errno_index_ready()
+{
+    int state = __atomic_load_n(&ec_errno_index.state, __ATOMIC_ACQUIRE);
+    if (state == 2) return 1;
+    if (state == 1) return 0;
+
+    if (!__atomic_compare_exchange_n(&ec_errno_index.state, &state, 1, 0,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        return state == 2;
+    }
+
+    for (size_t error = 0; error < EC_ERRNO_LEN; error++) {
+        if (ec_errno_table[error].type != NULL) {
+            ec_errno_index_add(ec_errno_table[error].type, (int)error);
+        }
+    }
+    for (size_t i = 0; i < sizeof(ec_errno_aliases) / sizeof(ec_errno_aliases[0]); i++) {
+        ec_errno_index_add(ec_errno_aliases[i].type, ec_errno_aliases[i].error);
+    }
+
+    __atomic_store_n(&ec_errno_index.state, 2, __ATOMIC_RELEASE);
+    return 1;
+}
+
+const char *
+ec_errno_type(int error)
+{
+    if (error > 0 && (size_t)error < EC_ERRNO_LEN &&
+        ec_errno_table[error].type != NULL) {
+        return ec_errno_table[error].type;
+    }
+    return ECX_EC;
+}
+
+int
+ec_type_errno(const char *type)
+{
+    if (type == NULL) return 0;
+
+    if (ec_errno_index_ready()) {
+        size_t i = ec_errno_hash(type);
+        while (ec_errno_index.slots[i].type != NULL) {
+            if (ec_errno_index.slots[i].type == type) {
+                return ec_errno_index.slots[i].error;
+            }
+            i = (i + 1) & (EC_ERRNO_INDEX_LEN - 1);
+        }
+        return 0;
+    }
+
+    for (size_t error = 0; error < EC_ERRNO_LEN; error++) {
+        if (ec_errno_table[error].type == type) return (int)error;
+    }
+    for (size_t i = 0; i < sizeof(ec_errno_aliases) / sizeof(ec_errno_aliases[0]); i++) {
+        if (ec_errno_aliases[i].type == type) return ec_errno_aliases[i].error;
+    }
+    return 0;
+}
+
+const char *
+ec_errno_name(int error)
+{
+    if (error > 0 && (size_t)error < EC_ERRNO_LEN) {
+        return ec_errno_table[error].name;
+    }
+    return NULL;
+}
+
+const char *
+ec_errno_str(int error)
+{
+    if (error > 0 && (size_t)error < EC_ERRNO_LEN) {
+        return ec_errno_table[error].str;
+    }
+    return NULL;
+}
+
+/*** Contexts ***/
+
+struct ec_context *
+ec_context_new()
+{
+    struct ec_context *context = calloc(1, sizeof(*context));
+    if (context == NULL) {
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate a context.");
+    }
+    return context;
+}
+
+void
+ec_context_free(struct ec_context *context)
+{
+    if (context == NULL) return;
+
+    if (context->error.data_cleanup != NULL) {
+        context->error.data_cleanup(context->error.data);
+    }
+    ec_causes_clean(&context->causes);
+    free(context->windings.slots);
+    free(context);
+}
+
+void
+ec_context_switch(struct ec_context *from, struct ec_context *to)
+{
+    struct ec *ec = ec_self();
+
+    from->env = ec->env;
+    from->winding = ec->winding;
+    from->windings = ec->windings;
+    from->error = ec->error;
+    from->place = ec->place;
+    ec_causes_move(&from->causes, &ec->causes);
+
+    ec->env = to->env;
+    ec->winding = to->winding;
+    ec->windings = to->windings;
+    ec->error = to->error;
+    ec->place = to->place;
+    ec_causes_move(&ec->causes, &to->causes);
+
+    /* The state is owned by exactly one place at a time (so freeing to, or
+     * the thread exiting, can't free its winding array or exception data
+     * twice).
+     */
+    to->env = NULL;
+    to->winding = NULL;
+    to->windings = (struct ec_windings){ .slots = NULL };
+    to->error = (struct ec_error){ .type = NULL };
+    to->place = (struct ec_place){ .file = NULL };
+}
+
+/*** Deferred Formatting ***/
+
+/* Per-thread captures. Two are enough for an exception being replaced by a
+ * new one, beyond that captures are allocated.
+ */
+#define EC_FMT_SLOTS 2
+
+/* How the argument of a conversion is passed. */
+enum ec_fmt_arg {
+    EC_FMT_ARG_NONE,        /* %% */
+    EC_FMT_ARG_INT,
+    EC_FMT_ARG_LONG,
+    EC_FMT_ARG_LLONG,
+    EC_FMT_ARG_INTMAX,
+    EC_FMT_ARG_SIZE,
+    EC_FMT_ARG_PTRDIFF,
+    EC_FMT_ARG_WINT,
+    EC_FMT_ARG_DOUBLE,
+    EC_FMT_ARG_LDOUBLE,
+    EC_FMT_ARG_PTR,
+    EC_FMT_ARG_STR,
+    EC_FMT_ARG_IGNORE,      /* %n */
+    EC_FMT_ARG_BAD,         /* Not understood. */
+};
+
+/* A conversion specification. */
+struct ec_fmt_spec {
+    /* The '%' and one past the conversion character. */
+    const char *start;
+    const char *end;
+
+    /* Width and precision given as '*' (passed as int arguments). */
+    int star_width;
+    int star_precision;
+
+    int is_unsigned;
+    enum ec_fmt_arg arg;
+};
+
+struct ec_fmt {
+    /* Borrowed, like the throw site. */
+    const char *format;
+
+    /* Rendering stops here (NULL if everything was captured). */
+    const char *stop;
+
+    /* 0 for a free slot, 1 for a slot in use, and 2 if allocated. */
+    int storage;
+
+    /* text is valid. */
+    int rendered;
+
+    /* Captured arguments in the order they are consumed. */
+    size_t args_len;
+    union {
+        long double align;
+        unsigned char bytes[EC_FMT_ARGS_MAX];
+    } args;
+
+    char text[EC_FMT_TEXT_MAX];
+};
+
+static __thread struct ec_fmt ec_fmt_slots[EC_FMT_SLOTS];
+
+/* Parse the conversion specification starting at spec->start. */
+static void
+ec_fmt_parse(struct ec_fmt_spec *spec)
+{
+    const char *p = spec->start + 1;
+    char length = '\0';
+
+    spec->star_width = 0;
+    spec->star_precision = 0;
+    spec->is_unsigned = 0;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) p++;
+
+    if (*p == '*') {
+        spec->star_width = 1;
+        p++;
+    }
+    else {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->star_precision = 1;
+            p++;
+        }
+        else {
+            while (*p >= '0' && *p <= '9') p++;
+        }
+    }
+
+    switch (*p) {
+        case 'h':
+            p++;
+            if (*p == 'h') p++;
+            length = 'h';
+            break;
+        case 'l':
+            p++;
+            length = 'l';
+            if (*p == 'l') {
+                p++;
+                length = 'q';
+            }
+            break;
+        case 'j': case 'z': case 't': case 'L':
+            length = *p++;
+            break;
+    }
+
+    char conversion = *p;
+    if (conversion != '\0') p++;
+    spec->end = p;
+
+    switch (conversion) {
+        case '%':
+            spec->arg = EC_FMT_ARG_NONE;
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            spec->is_unsigned = 1;
+            /* Fall through. */
+        case 'd': case 'i':
+            switch (length) {
+                case 'l': spec->arg = EC_FMT_ARG_LONG; break;
+                case 'q': spec->arg = EC_FMT_ARG_LLONG; break;
+                case 'j': spec->arg = EC_FMT_ARG_INTMAX; break;
+                case 'z': spec->arg = EC_FMT_ARG_SIZE; break;
+                case 't': spec->arg = EC_FMT_ARG_PTRDIFF; break;
+                case 'L': spec->arg = EC_FMT_ARG_BAD; break;
+                default: spec->arg = EC_FMT_ARG_INT; break;
+            }
+            break;
+        case 'c':
+            spec->arg = length == 'l' ? EC_FMT_ARG_WINT : EC_FMT_ARG_INT;
+            break;
+        case 's':
+            /* Wide strings aren't captured. */
+            spec->arg = length == 'l' ? EC_FMT_ARG_BAD : EC_FMT_ARG_STR;
+            break;
+        case 'p':
+            spec->arg = EC_FMT_ARG_PTR;
+            break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            spec->arg = length == 'L' ? EC_FMT_ARG_LDOUBLE : EC_FMT_ARG_DOUBLE;
+            break;
+        case 'n':
+            spec->arg = EC_FMT_ARG_IGNORE;
+            break;
+        default:
+            spec->arg = EC_FMT_ARG_BAD;
+            break;
+    }
+}
+
+/* Returns the next suitably aligned offset for a value of the given size. */
+static size_t
+ec_fmt_align(size_t offset, size_t size)
+{
+    size_t align = size < sizeof(long double) ? size : sizeof(long double);
+    return (offset + align - 1) / align * align;
+}
+
+/* Returns storage for a value of the given size or NULL if there is no room. */
+static void *
+ec_fmt_push(struct ec_fmt *fmt, size_t size)
+{
+    size_t offset = ec_fmt_align(fmt->args_len, size);
+    if (offset + size > EC_FMT_ARGS_MAX) return NULL;
+
+    fmt->args_len = offset + size;
+    return &fmt->args.bytes[offset];
+}
+
+static const void *
+ec_fmt_pop(const struct ec_fmt *fmt, size_t *offset, size_t size)
+{
+    *offset = ec_fmt_align(*offset, size);
+    const void *value = &fmt->args.bytes[*offset];
+    *offset += size;
+    return value;
+}
+
+#define EC_FMT_CAPTURE(type) { \
+    type value_ = va_arg(*ap, type); \
+    void *storage_ = ec_fmt_push(fmt, sizeof(type)); \
+    if (storage_ == NULL) return spec->start; \
+    memcpy(storage_, &value_, sizeof(type)); \
+}
+
+/* Capture the arguments of a conversion. Returns NULL on success, otherwise
+ * where rendering should stop.
+ */
+static const char *
+ec_fmt_capture_spec(struct ec_fmt *fmt, struct ec_fmt_spec *spec, va_list *ap)
+{
+    if (spec->star_width) EC_FMT_CAPTURE(int);
+    if (spec->star_precision) EC_FMT_CAPTURE(int);
+
+    switch (spec->arg) {
+        case EC_FMT_ARG_NONE: break;
+        case EC_FMT_ARG_INT: EC_FMT_CAPTURE(int); break;
+        case EC_FMT_ARG_LONG: EC_FMT_CAPTURE(long); break;
+        case EC_FMT_ARG_LLONG: EC_FMT_CAPTURE(long long); break;
+        case EC_FMT_ARG_INTMAX: EC_FMT_CAPTURE(intmax_t); break;
+        case EC_FMT_ARG_SIZE: EC_FMT_CAPTURE(size_t); break;
+        case EC_FMT_ARG_PTRDIFF: EC_FMT_CAPTURE(ptrdiff_t); break;
+        case EC_FMT_ARG_WINT: EC_FMT_CAPTURE(wint_t); break;
+        case EC_FMT_ARG_DOUBLE: EC_FMT_CAPTURE(double); break;
+        case EC_FMT_ARG_LDOUBLE: EC_FMT_CAPTURE(long double); break;
+        case EC_FMT_ARG_PTR: EC_FMT_CAPTURE(void *); break;
+        case EC_FMT_ARG_STR: {
+            const char *str = va_arg(*ap, const char *);
+            if (str == NULL) str = "(null)";
+
+            size_t room = EC_FMT_ARGS_MAX - fmt->args_len;
+            if (room == 0) return spec->start;
+
+            size_t len = strlen(str);
+            char *copy = (char *)&fmt->args.bytes[fmt->args_len];
+            if (len >= room) {
+                /* Keep what fits and stop after it. */
+                memcpy(copy, str, room - 1);
+                copy[room - 1] = '\0';
+                fmt->args_len = EC_FMT_ARGS_MAX;
+                return spec->end;
+            }
+
+            memcpy(copy, str, len + 1);
+            fmt->args_len += len + 1;
+            break;
+        }
+        case EC_FMT_ARG_IGNORE:
+            (void)va_arg(*ap, void *);
+            break;
+        case EC_FMT_ARG_BAD:
+            return spec->start;
+    }
+
+    return NULL;
+}
+
+#undef EC_FMT_CAPTURE
+
+struct ec_fmt *
+ec_fmt_capture(const char *format, ...)
+{
+    struct ec_fmt *fmt = NULL;
+
+    for (int i = 0; i < EC_FMT_SLOTS; i++) {
+        if (ec_fmt_slots[i].storage == 0) {
+            fmt = &ec_fmt_slots[i];
+            fmt->storage = 1;
+            break;
+        }
+    }
+
+    if (fmt == NULL) {
+        fmt = malloc(sizeof(*fmt));
+        if (fmt == NULL) return NULL;
+        fmt->storage = 2;
+    }
+
+    fmt->format = format;
+    fmt->stop = NULL;
+    fmt->rendered = 0;
+    fmt->args_len = 0;
+
+    va_list ap;
+    va_start(ap, format);
+
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '%') continue;
+
+        struct ec_fmt_spec spec = { .start = p };
+        ec_fmt_parse(&spec);
+
+        fmt->stop = ec_fmt_capture_spec(fmt, &spec, &ap);
+        if (fmt->stop != NULL) break;
+
+        p = spec.end - 1;
+    }
+
+    va_end(ap);
+
+    return fmt;
+}
+
+void
+ec_fmt_release(struct ec_fmt *fmt)
+{
+    if (fmt == NULL) return;
+
+    if (fmt->storage == 2) {
+        free(fmt);
+    }
+    else {
+        fmt->storage = 0;
+    }
+}
+
+/* Emit to the stream if there is one, otherwise append to the buffer. */
+#define EC_FMT_EMIT(...) { \
+    if (stream != NULL) { \
+        fprintf(stream, __VA_ARGS__); \
+    } \
+    else { \
+        int n_ = snprintf(buf + len, size - len, __VA_ARGS__); \
+        if (n_ > 0 && (size_t)n_ >= size - len) full = 1; \
+        if (n_ > 0) len = full ? size - 1 : len + n_; \
+    } \
+}
+
+#define EC_FMT_VALUE(type) (*(const type *)ec_fmt_pop(fmt, &offset, sizeof(type)))
+
+static void
+ec_fmt_render(const struct ec_fmt *fmt, FILE *stream, char *buf, size_t size)
+{
+    const char *p = fmt->format;
+    const char *stop = fmt->stop;
+    size_t len = 0, offset = 0;
+    int full = 0;
+
+    if (buf != NULL) buf[0] = '\0';
+
+    while (*p != '\0' && (stop == NULL || p < stop)) {
+        /* Literal text up to the next conversion (or the stop). */
+        const char *next = strchr(p, '%');
+        if (next == NULL) next = p + strlen(p);
+        if (stop != NULL && next > stop) next = stop;
+
+        if (next > p) {
+            EC_FMT_EMIT("%.*s", (int)(next - p), p);
+            p = next;
+            continue;
+        }
+
+        struct ec_fmt_spec spec = { .start = p };
+        ec_fmt_parse(&spec);
+        p = spec.end;
+
+        /* Rebuild the specification with the '*'s replaced by their values. */
+        char conversion[64];
+        size_t c = 0;
+        for (const char *q = spec.start; q < spec.end && c < sizeof(conversion) - 16; q++) {
+            if (*q == '*') {
+                c += snprintf(&conversion[c], sizeof(conversion) - c, "%d", EC_FMT_VALUE(int));
+            }
+            else {
+                conversion[c++] = *q;
+            }
+        }
+        conversion[c] = '\0';
+
+        switch (spec.arg) {
+            case EC_FMT_ARG_NONE:
+                EC_FMT_EMIT("%%");
+                break;
+            case EC_FMT_ARG_INT:
+                if (spec.is_unsigned) EC_FMT_EMIT(conversion, (unsigned int)EC_FMT_VALUE(int))
+                else EC_FMT_EMIT(conversion, EC_FMT_VALUE(int))
+                break;
+            case EC_FMT_ARG_LONG:
+                if (spec.is_unsigned) EC_FMT_EMIT(conversion, (unsigned long)EC_FMT_VALUE(long))
+                else EC_FMT_EMIT(conversion, EC_FMT_VALUE(long))
+                break;
+            case EC_FMT_ARG_LLONG:
+                if (spec.is_unsigned) EC_FMT_EMIT(conversion, (unsigned long long)EC_FMT_VALUE(long long))
+                else EC_FMT_EMIT(conversion, EC_FMT_VALUE(long long))
+                break;
+            case EC_FMT_ARG_INTMAX:
+                if (spec.is_unsigned) EC_FMT_EMIT(conversion, (uintmax_t)EC_FMT_VALUE(intmax_t))
+                else EC_FMT_EMIT(conversion, EC_FMT_VALUE(intmax_t))
+                break;
+            case EC_FMT_ARG_SIZE:
+                if (spec.is_unsigned) EC_FMT_EMIT(conversion, EC_FMT_VALUE(size_t))
+                else EC_FMT_EMIT(conversion, (ssize_t)EC_FMT_VALUE(size_t))
+                break;
+            case EC_FMT_ARG_PTRDIFF:
+                EC_FMT_EMIT(conversion, EC_FMT_VALUE(ptrdiff_t));
+                break;
+            case EC_FMT_ARG_WINT:
+                EC_FMT_EMIT(conversion, EC_FMT_VALUE(wint_t));
+                break;
+            case EC_FMT_ARG_DOUBLE:
+                EC_FMT_EMIT(conversion, EC_FMT_VALUE(double));
+                break;
+            case EC_FMT_ARG_LDOUBLE:
+                EC_FMT_EMIT(conversion, EC_FMT_VALUE(long double));
+                break;
+            case EC_FMT_ARG_PTR:
+                EC_FMT_EMIT(conversion, EC_FMT_VALUE(void *));
+                break;
+            case EC_FMT_ARG_STR: {
+                const char *str = (const char *)&fmt->args.bytes[offset];
+                offset += strlen(str) + 1;
+                EC_FMT_EMIT(conversion, str);
+                break;
+            }
+            case EC_FMT_ARG_IGNORE:
+            case EC_FMT_ARG_BAD:
+                break;
+        }
+    }
+
+    if (stop != NULL) EC_FMT_EMIT("...");
+
+    /* Out of room in the buffer: Mark the text as cut short. */
+    if (full && size > 3) memcpy(&buf[size - 4], "...", 3);
+}
+
+#undef EC_FMT_VALUE
+#undef EC_FMT_EMIT
+
+/* The format of the capture (for the flight recorder). */
+static const char *
+ec_fmt_format(const struct ec_fmt *fmt)
+{
+    return fmt->format;
+}
+
+const char *
+ec_fmt_str(const struct ec_fmt *fmt)
+{
+    if (fmt == NULL) return NULL;
+
+    /* Rendering is a cache fill, the capture is logically unchanged. */
+    struct ec_fmt *mutable = (struct ec_fmt *)fmt;
+    if (!mutable->rendered) {
+        ec_fmt_render(fmt, NULL, mutable->text, sizeof(mutable->text));
+        mutable->rendered = 1;
+    }
+
+    return fmt->text;
+}
+
+void
+ec_fprint_fmt(FILE *stream, const struct ec_fmt *fmt)
+{
+    if (fmt == NULL) return;
+
+    ec_fmt_render(fmt, stream, NULL, 0);
+}
+
+/* Moves a capture out of the per-thread storage (if it is there) so that it
+ * can be released by another thread. Returns NULL if that allocation fails.
+ */
+static struct ec_fmt *
+ec_fmt_detach(struct ec_fmt *fmt)
+{
+    if (fmt == NULL || fmt->storage == 2) return fmt;
+
+    struct ec_fmt *copy = malloc(sizeof(*copy));
+    if (copy == NULL) return NULL;
+
+    memcpy(copy, fmt, sizeof(*copy));
+    copy->storage = 2;
+
+    fmt->storage = 0;
+    return copy;
+}
+
+/*** Exception Objects ***/
+
+struct ec_exception {
+    struct ec_error error;
+    struct ec_place place;
+    struct ec_causes causes;
+};
+
+/* Moves the data of an error out of the per-thread storage (if it is there)
+ * so that it outlives the thread's later exceptions and can be released by
+ * another thread. Returns 0 if that allocation fails, leaving the error as it
+ * was.
+ */
+static int
+ec_error_detach(struct ec_error *error)
+{
+    if (error->data_cleanup == (void (*)(void *))ec_fmt_release) {
+        struct ec_fmt *fmt = ec_fmt_detach(error->data);
+        if (fmt == NULL) return 0;
+
+        error->data = fmt;
+    }
+    /* Faults are kept in a small per-thread ring (see src/fault.c), later
+     * faults would overwrite them.
+     */
+    else if (error->data_fprint == (void (*)(FILE *, void *))ec_fprint_fault &&
+             error->data_cleanup == NULL &&
+             error->data != NULL) {
+        struct ec_fault *fault = malloc(sizeof(*fault));
+        if (fault == NULL) return 0;
+
+        memcpy(fault, error->data, sizeof(*fault));
+        error->data = fault;
+        error->data_cleanup = free;
+    }
+
+    return 1;
+}
+
+struct ec_exception *
+ec_exception_capture()
+{
+    struct ec *ec = ec_self();
+
+    if (ec->error.type == NULL) return NULL;
+
+    struct ec_exception *exception = malloc(sizeof(*exception));
+    if (exception == NULL) {
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate an exception object.");
+    }
+
+    /* Data in per-thread storage (of the deferred formatting or of faults)
+     * can't leave the thread (everything else is already independent of it).
+     */
+    if (!ec_error_detach(&ec->error)) {
+        free(exception);
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate an exception object.");
+    }
+
+    exception->error = ec->error;
+    exception->place = ec->place;
+    ec_causes_move(&exception->causes, &ec->causes);
+
+    /* The same goes for the causes, though one that can't be moved is only
+     * dropped.
+     */
+    struct ec_causes *causes = &exception->causes;
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < causes->len; i++) {
+        struct ec_cause_entry *entry = &causes->entries[i];
+
+        if (!ec_error_detach(&entry->error)) {
+            if (entry->error.data_cleanup != NULL) {
+                entry->error.data_cleanup(entry->error.data);
+            }
+            causes->dropped++;
+            continue;
+        }
+
+        causes->entries[kept++] = *entry;
+    }
+    causes->len = kept;
+
+    /* It has been caught (though not cleaned up here). */
+    ec_inline_count(&ec->stats.counts.catches);
+
+    memset(&ec->error, 0, sizeof(ec->error));
+    memset(&ec->place, 0, sizeof(ec->place));
+
+    return exception;
+}
+
+void
+ec_exception_restore(struct ec_exception *exception)
+{
+    if (exception == NULL) return;
+
+    ec_set_error(
+            exception->error.type,
+            exception->error.data,
+            exception->error.data_cleanup,
+            exception->error.data_fprint);
+    ec_stack.error.desc = exception->error.desc;
+    ec_stack.error.errnum = exception->error.errnum;
+    ec_stack.place = exception->place;
+
+    /* Its causes follow any exception it replaced. */
+    for (unsigned int i = 0; i < exception->causes.len; i++) {
+        ec_causes_add(&ec_stack.causes,
+                &exception->causes.entries[i].error,
+                &exception->causes.entries[i].place);
+    }
+    ec_stack.causes.dropped += exception->causes.dropped;
+
+    free(exception);
+}
+
+const char *
+ec_exception_type(const struct ec_exception *exception)
+{
+    return exception->error.type;
+}
+
+void
+ec_exception_free(struct ec_exception *exception)
+{
+    if (exception == NULL) return;
+
+    if (exception->error.data_cleanup != NULL) {
+        exception->error.data_cleanup(exception->error.data);
+    }
+    ec_causes_clean(&exception->causes);
+    free(exception);
+}
+
+/*** Core Dumps ***/
+
+#define EC_CORE_TYPES_MAX 32
+
+/* Process wide core policy. The policy is read without locking on every
+ * throw, the counters are only touched by the policies that need them.
+ */
+static struct {
+    enum ec_core_policy policy;
+    unsigned long n;
+
+    /* EC_CORE_FIRST_N: Number of dumps so far. */
+    unsigned long count;
+
+    /* EC_CORE_RATE: The current second and the dumps made in it. */
+    time_t second;
+    unsigned long second_count;
+
+    /* Per-type overrides. Entries are only ever appended (under lock) and the
+     * length is published after the entry is complete.
+     */
+    struct {
+        const char *type;
+        int dump;
+    } types[EC_CORE_TYPES_MAX];
+    unsigned int types_len;
+    char types_lock;
+} ec_core = {
+    .policy = EC_CORE_ALWAYS,
+};
+
+/* EC_CORE_SAMPLE: Throws seen by this thread. */
+static __thread unsigned long ec_core_sample_count = 0;
+
+void
+ec_core_policy(enum ec_core_policy policy, unsigned long n)
+{
+    __atomic_store_n(&ec_core.n, n, __ATOMIC_RELAXED);
+    __atomic_store_n(&ec_core.count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ec_core.second, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ec_core.second_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ec_core.policy, policy, __ATOMIC_RELEASE);
+}
+
+void
+ec_core_type(const char *type, int dump)
+{
+    while (__atomic_test_and_set(&ec_core.types_lock, __ATOMIC_ACQUIRE));
+
+    unsigned int i;
+    for (i = 0; i < ec_core.types_len; i++) {
+        if (ec_core.types[i].type == type) break;
+    }
+
+    if (i == EC_CORE_TYPES_MAX) {
+        __atomic_clear(&ec_core.types_lock, __ATOMIC_RELEASE);
+        ec_throw_str_static(ECX_ENOBUFS, "Too many core type overrides.");
+    }
+
+    __atomic_store_n(&ec_core.types[i].dump, dump, __ATOMIC_RELAXED);
+    if (i == ec_core.types_len) {
+        ec_core.types[i].type = type;
+        __atomic_store_n(&ec_core.types_len, i + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_clear(&ec_core.types_lock, __ATOMIC_RELEASE);
+}
+
+int
+ec_core_check(const char *type)
+{
+    unsigned int types_len = __atomic_load_n(&ec_core.types_len, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < types_len; i++) {
+        if (ec_core.types[i].type == type) {
+            int dump = __atomic_load_n(&ec_core.types[i].dump, __ATOMIC_RELAXED);
+            if (dump >= 0) return dump;
+            break;
+        }
+    }
+
+    unsigned long n = __atomic_load_n(&ec_core.n, __ATOMIC_RELAXED);
+
+    switch (__atomic_load_n(&ec_core.policy, __ATOMIC_ACQUIRE)) {
+        case EC_CORE_ALWAYS:
+            return 1;
+        case EC_CORE_OFF:
+            return 0;
+        case EC_CORE_FIRST_N:
+            if (__atomic_load_n(&ec_core.count, __ATOMIC_RELAXED) >= n) return 0;
+            return __atomic_fetch_add(&ec_core.count, 1, __ATOMIC_RELAXED) < n;
+        case EC_CORE_SAMPLE:
+            return n != 0 && ec_core_sample_count++ % n == 0;
+        case EC_CORE_RATE: {
+            time_t now = time(NULL);
+            time_t second = __atomic_load_n(&ec_core.second, __ATOMIC_RELAXED);
+            if (second != now &&
+                __atomic_compare_exchange_n(&ec_core.second, &second, now, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&ec_core.second_count, 0, __ATOMIC_RELAXED);
+            }
+            if (__atomic_load_n(&ec_core.second_count, __ATOMIC_RELAXED) >= n) return 0;
+            return __atomic_fetch_add(&ec_core.second_count, 1, __ATOMIC_RELAXED) < n;
+        }
+    }
+
+    return 1;
+}
+
+void
+ec_core_dump()
+{
+#ifdef HAVE_WORKING_FORK
+    if (ec_core_check(ec_stack.error.type)) {
+        pid_t pid = fork();
+        if (pid == 0) abort();
+        if (pid > 0) waitpid(pid, NULL, 0);
     }
+#endif
 }
 
 /***Exception Types ***/
@@ -0,0 +1,350 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ec/ec.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+/*** Faults
+ *
+ * The handlers are installed with SA_NODEFER and an empty mask, so the fault
+ * signal isn't blocked while they run. That way jumping out of the handler
+ * leaves the signal mask as it was, whether or not the ec_try saved it (see
+ * ec_try_nosig and EC_FASTJMP).
+ *
+ * Once the jump is made the kernel no longer considers the thread to be on
+ * its alternate stack (that is decided by the stack pointer), so it can be
+ * used again by the next fault.
+ *
+ ***/
+
+const char ECX_SEGV[] = "SIGSEGV";
+const char ECX_BUS[] = "SIGBUS";
+const char ECX_FPE[] = "SIGFPE";
+const char ECX_STACK_OVERFLOW[] = "Stack overflow";
+
+static const int ec_fault_signals[] = { SIGSEGV, SIGBUS, SIGFPE };
+
+#define EC_FAULT_SIGNALS (sizeof(ec_fault_signals) / sizeof(ec_fault_signals[0]))
+
+/* Faults kept per thread (the current exception and each of its causes may be
+ * a fault). The handler can't allocate, ec_exception_capture() copies a fault
+ * out of here.
+ */
+#define EC_FAULT_SLOTS (EC_CAUSES_MAX + 1)
+
+static struct {
+    pthread_mutex_t lock;
+    int installed;
+    struct sigaction previous[EC_FAULT_SIGNALS];
+
+    /* The program's ec_longjmp (see ec_fault_install_(...)). */
+    void (*jump)();
+
+    pthread_once_t once;
+    pthread_key_t key;
+    int key_ok;
+} ec_fault = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static __thread struct {
+    /* The alternate signal stack (NULL until set up). */
+    void *altstack;
+
+    /* The lowest address of the thread's stack and the size of the guard
+     * below it (0 if unknown).
+     */
+    char *stack_low;
+    size_t guard;
+
+    /* Set while a fault is being handled. */
+    int handling;
+
+    struct ec_fault faults[EC_FAULT_SLOTS];
+    unsigned int next;
+} ec_fault_thread;
+
+/* Called when a thread with an alternate stack exits. */
+static void
+ec_fault_thread_free(void *altstack)
+{
+    stack_t disable = { .ss_flags = SS_DISABLE };
+    sigaltstack(&disable, NULL);
+    free(altstack);
+}
+
+static void
+ec_fault_init()
+{
+    ec_fault.key_ok = pthread_key_create(&ec_fault.key, ec_fault_thread_free) == 0;
+}
+
+/* Records where the calling thread's stack ends. */
+static void
+ec_fault_stack_bounds()
+{
+#if defined(_GNU_SOURCE) && defined(__GLIBC__)
+    pthread_attr_t attr;
+    void *low = NULL;
+    size_t size = 0;
+    size_t guard = 0;
+
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return;
+
+    if (pthread_attr_getstack(&attr, &low, &size) == 0 &&
+        pthread_attr_getguardsize(&attr, &guard) == 0) {
+        /* The initial thread reports no guard, but the kernel keeps a gap
+         * below its stack.
+         */
+        long page = sysconf(_SC_PAGESIZE);
+        if (guard < (size_t)page) guard = page;
+
+        ec_fault_thread.stack_low = low;
+        ec_fault_thread.guard = guard;
+    }
+
+    pthread_attr_destroy(&attr);
+#endif
+}
+
+void
+ec_fault_thread_init()
+{
+    if (ec_fault_thread.altstack != NULL) return;
+
+    pthread_once(&ec_fault.once, ec_fault_init);
+
+    size_t size = EC_FAULT_STACK_SIZE;
+    if (size < (size_t)SIGSTKSZ) size = SIGSTKSZ;
+
+    void *altstack = malloc(size);
+    if (altstack == NULL) {
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate the signal stack.");
+    }
+
+    stack_t stack = { .ss_sp = altstack, .ss_size = size, .ss_flags = 0 };
+    if (sigaltstack(&stack, NULL) != 0) {
+        int error = errno;
+        free(altstack);
+        ec_throw_errno(error, NULL) NULL;
+    }
+
+    ec_fault_thread.altstack = altstack;
+    if (ec_fault.key_ok) pthread_setspecific(ec_fault.key, altstack);
+
+    ec_fault_stack_bounds();
+}
+
+/* Returns the faulting instruction from the signal context (NULL if
+ * unknown).
+ */
+static void *
+ec_fault_pc(void *context)
+{
+    ucontext_t *uc = context;
+    (void)uc;
+
+#if defined(__x86_64__) && defined(REG_RIP)
+    return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__) && defined(REG_EIP)
+    return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__) && defined(__linux__)
+    return (void *)uc->uc_mcontext.pc;
+#else
+    return NULL;
+#endif
+}
+
+/* Passes the signal on to the handler installed before ours. */
+static void
+ec_fault_chain(int signo, siginfo_t *info, void *context)
+{
+    struct sigaction *previous = NULL;
+    for (size_t i = 0; i < EC_FAULT_SIGNALS; i++) {
+        if (ec_fault_signals[i] == signo) previous = &ec_fault.previous[i];
+    }
+
+    if (previous != NULL && (previous->sa_flags & SA_SIGINFO)) {
+        previous->sa_sigaction(signo, info, context);
+        return;
+    }
+
+    if (previous != NULL &&
+        previous->sa_handler != SIG_DFL &&
+        previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(signo);
+        return;
+    }
+
+    /* Returning retries the faulting instruction, which now gets the default
+     * action (a signal sent with kill(...) has to be sent again).
+     */
+    signal(signo, SIG_DFL);
+    if (info->si_code <= 0) raise(signo);
+}
+
+static void
+ec_fault_handler(int signo, siginfo_t *info, void *context)
+{
+    int saved = errno;
+
+    /* Sent by kill(...) or the like, not a fault. */
+    if (info->si_code <= 0 ||
+        ec_fault_thread.handling ||
+        ec_env(NULL) == NULL) {
+        ec_fault_chain(signo, info, context);
+        errno = saved;
+        return;
+    }
+
+    ec_fault_thread.handling = 1;
+
+    struct ec_fault *fault =
+        &ec_fault_thread.faults[ec_fault_thread.next++ % EC_FAULT_SLOTS];
+    fault->signo = signo;
+    fault->code = info->si_code;
+    fault->addr = info->si_addr;
+    fault->pc = ec_fault_pc(context);
+
+    const char *type = ECX_SEGV;
+    if (signo == SIGBUS) type = ECX_BUS;
+    if (signo == SIGFPE) type = ECX_FPE;
+
+    /* Stack overflows are reported as faults just below the stack. */
+    char *addr = info->si_addr;
+    char *low = ec_fault_thread.stack_low;
+    if (signo == SIGSEGV && low != NULL &&
+        addr < low && addr >= low - ec_fault_thread.guard) {
+        type = ECX_STACK_OVERFLOW;
+    }
+
+    ec_set_error(type, fault, NULL, (void (*)(FILE *, void *))ec_fprint_fault);
+    ec_set_place_fault_("<fault>", "<fault>", 0);
+    ec_unwind(EC_UNWIND_ALL);
+
+    ec_fault_thread.handling = 0;
+    ec_fault.jump();
+}
+
+void
+ec_fault_install_(void (*jump)())
+{
+    ec_fault_thread_init();
+
+    pthread_mutex_lock(&ec_fault.lock);
+
+    ec_fault.jump = jump;
+
+    if (ec_fault.installed) {
+        pthread_mutex_unlock(&ec_fault.lock);
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = ec_fault_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    for (size_t i = 0; i < EC_FAULT_SIGNALS; i++) {
+        if (sigaction(ec_fault_signals[i], &action, &ec_fault.previous[i]) != 0) {
+            int error = errno;
+
+            while (i-- > 0) {
+                sigaction(ec_fault_signals[i], &ec_fault.previous[i], NULL);
+            }
+
+            pthread_mutex_unlock(&ec_fault.lock);
+            ec_throw_errno(error, NULL) NULL;
+        }
+    }
+
+    ec_fault.installed = 1;
+
+    pthread_mutex_unlock(&ec_fault.lock);
+}
+
+void
+ec_fault_uninstall()
+{
+    pthread_mutex_lock(&ec_fault.lock);
+
+    if (ec_fault.installed) {
+        for (size_t i = 0; i < EC_FAULT_SIGNALS; i++) {
+            sigaction(ec_fault_signals[i], &ec_fault.previous[i], NULL);
+        }
+        ec_fault.installed = 0;
+    }
+
+    pthread_mutex_unlock(&ec_fault.lock);
+}
+
+/* Describes the si_code of a fault (NULL if unknown). */
+static const char *
+ec_fault_code_str(int signo, int code)
+{
+    switch (signo) {
+        case SIGSEGV:
+            if (code == SEGV_MAPERR) return "Address not mapped";
+            if (code == SEGV_ACCERR) return "Invalid permissions";
+            break;
+        case SIGBUS:
+            if (code == BUS_ADRALN) return "Invalid address alignment";
+            if (code == BUS_ADRERR) return "Nonexistent physical address";
+            if (code == BUS_OBJERR) return "Object-specific hardware error";
+            break;
+        case SIGFPE:
+            if (code == FPE_INTDIV) return "Integer divide by zero";
+            if (code == FPE_INTOVF) return "Integer overflow";
+            if (code == FPE_FLTDIV) return "Floating-point divide by zero";
+            if (code == FPE_FLTOVF) return "Floating-point overflow";
+            if (code == FPE_FLTUND) return "Floating-point underflow";
+            if (code == FPE_FLTRES) return "Floating-point inexact result";
+            if (code == FPE_FLTINV) return "Invalid floating-point operation";
+            if (code == FPE_FLTSUB) return "Subscript out of range";
+            break;
+    }
+
+    return NULL;
+}
+
+void
+ec_fprint_fault(FILE *stream, const struct ec_fault *fault)
+{
+    const char *code = ec_fault_code_str(fault->signo, fault->code);
+    if (code != NULL) {
+        fprintf(stream, "%s", code);
+    }
+    else {
+        fprintf(stream, "Code %d", fault->code);
+    }
+
+    fprintf(stream, " at %p", fault->addr);
+
+    if (fault->pc != NULL) {
+        fprintf(stream, " (pc %p)", fault->pc);
+    }
+}
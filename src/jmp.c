@@ -0,0 +1,121 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ec/ec.h>
+
+/*** Fast Jump
+ *
+ * Minimal replacements for sigsetjmp/siglongjmp used by ec_try when
+ * EC_FASTJMP is defined. Only what a throw needs is saved: the callee-saved
+ * registers, the stack pointer and the address to resume at. The signal mask
+ * is left alone and pointers are not mangled.
+ *
+ * See struct ec_fastjmp in ec/ec.h for the layout of the buffer.
+ *
+ ***/
+
+#if defined(__x86_64__) && defined(__ELF__)
+
+__asm__(
+    "    .text\n"
+    "    .globl ec_fastjmp_save\n"
+    "    .type ec_fastjmp_save, @function\n"
+    "ec_fastjmp_save:\n"
+    "    movq %rbx, 0(%rdi)\n"
+    "    movq %rbp, 8(%rdi)\n"
+    "    movq %r12, 16(%rdi)\n"
+    "    movq %r13, 24(%rdi)\n"
+    "    movq %r14, 32(%rdi)\n"
+    "    movq %r15, 40(%rdi)\n"
+    /* The stack pointer of the caller once we have returned. */
+    "    leaq 8(%rsp), %rdx\n"
+    "    movq %rdx, 48(%rdi)\n"
+    /* The return address is where to resume. */
+    "    movq (%rsp), %rdx\n"
+    "    movq %rdx, 56(%rdi)\n"
+    "    xorl %eax, %eax\n"
+    "    ret\n"
+    "    .size ec_fastjmp_save, .-ec_fastjmp_save\n"
+    "\n"
+    "    .globl ec_fastjmp_restore\n"
+    "    .type ec_fastjmp_restore, @function\n"
+    "ec_fastjmp_restore:\n"
+    /* Like longjmp, a value of 0 is returned as 1. */
+    "    movl %esi, %eax\n"
+    "    testl %eax, %eax\n"
+    "    jnz 1f\n"
+    "    incl %eax\n"
+    "1:\n"
+    "    movq 0(%rdi), %rbx\n"
+    "    movq 8(%rdi), %rbp\n"
+    "    movq 16(%rdi), %r12\n"
+    "    movq 24(%rdi), %r13\n"
+    "    movq 32(%rdi), %r14\n"
+    "    movq 40(%rdi), %r15\n"
+    "    movq 48(%rdi), %rsp\n"
+    "    jmpq *56(%rdi)\n"
+    "    .size ec_fastjmp_restore, .-ec_fastjmp_restore\n"
+);
+
+#elif defined(__aarch64__) && defined(__ELF__)
+
+__asm__(
+    "    .text\n"
+    "    .globl ec_fastjmp_save\n"
+    "    .type ec_fastjmp_save, %function\n"
+    "ec_fastjmp_save:\n"
+    "    stp x19, x20, [x0, #0]\n"
+    "    stp x21, x22, [x0, #16]\n"
+    "    stp x23, x24, [x0, #32]\n"
+    "    stp x25, x26, [x0, #48]\n"
+    "    stp x27, x28, [x0, #64]\n"
+    /* The frame pointer and the link register (where to resume). */
+    "    stp x29, x30, [x0, #80]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0, #96]\n"
+    "    stp d8, d9, [x0, #104]\n"
+    "    stp d10, d11, [x0, #120]\n"
+    "    stp d12, d13, [x0, #136]\n"
+    "    stp d14, d15, [x0, #152]\n"
+    "    mov w0, #0\n"
+    "    ret\n"
+    "    .size ec_fastjmp_save, .-ec_fastjmp_save\n"
+    "\n"
+    "    .globl ec_fastjmp_restore\n"
+    "    .type ec_fastjmp_restore, %function\n"
+    "ec_fastjmp_restore:\n"
+    "    ldp x19, x20, [x0, #0]\n"
+    "    ldp x21, x22, [x0, #16]\n"
+    "    ldp x23, x24, [x0, #32]\n"
+    "    ldp x25, x26, [x0, #48]\n"
+    "    ldp x27, x28, [x0, #64]\n"
+    "    ldp x29, x30, [x0, #80]\n"
+    "    ldr x2, [x0, #96]\n"
+    "    mov sp, x2\n"
+    "    ldp d8, d9, [x0, #104]\n"
+    "    ldp d10, d11, [x0, #120]\n"
+    "    ldp d12, d13, [x0, #136]\n"
+    "    ldp d14, d15, [x0, #152]\n"
+    /* Like longjmp, a value of 0 is returned as 1. */
+    "    cmp w1, #0\n"
+    "    csinc w0, w1, wzr, ne\n"
+    "    ret\n"
+    "    .size ec_fastjmp_restore, .-ec_fastjmp_restore\n"
+);
+
+#endif
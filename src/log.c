@@ -0,0 +1,556 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ec/ec.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/*** Logging
+ *
+ * Each thread that logs gets a single producer, single consumer ring: The
+ * thread copies its record in and then publishes it by advancing head, the
+ * writer copies records out (with writev) and then frees the space by
+ * advancing tail. The positions only ever increase, a byte's offset in the
+ * ring is its position modulo EC_LOG_RING_SIZE.
+ *
+ * The rings are kept in a list guarded by the sink lock. A ring belongs to
+ * its thread until the thread exits, after which the writer frees it once it
+ * has been drained.
+ *
+ * The writer sleeps on a semaphore when every ring is empty. It sets sleeping
+ * before its last look at the rings, and producers check sleeping after
+ * publishing, so at least one of them sees the other.
+ *
+ ***/
+
+#define EC_LOG_LINE 64
+
+/* Rings written out by each writev(...) (each takes up to two vectors). */
+#define EC_LOG_BATCH 32
+
+/* Empty passes the writer makes before it sleeps. */
+#define EC_LOG_SPINS 64
+
+struct ec_log_ring {
+    /* Written by the producer, read by the writer (atomic). */
+    size_t head __attribute__((aligned(EC_LOG_LINE)));
+
+    /* Written by the writer, read by the producer (atomic). */
+    size_t tail __attribute__((aligned(EC_LOG_LINE)));
+
+    /* Guarded by the sink lock. */
+    struct ec_log_ring *next __attribute__((aligned(EC_LOG_LINE)));
+    int orphaned;
+
+    /* Used by the producer to format records (opened on record). */
+    FILE *stream;
+    char record[EC_LOG_RECORD_MAX + 1];
+
+    char data[EC_LOG_RING_SIZE];
+};
+
+static struct {
+    pthread_once_t once;
+    pthread_key_t key;
+    int key_ok;
+
+    /* Guards the list of rings, running and thread. */
+    pthread_mutex_t lock;
+    struct ec_log_ring *rings;
+
+    /* Set while the writer thread is started (atomic). */
+    int running;
+    int stopping;
+    pthread_t thread;
+    int fd;
+
+    /* Posted to wake the writer. */
+    sem_t wake;
+    int sleeping;
+
+    /* Completed writer passes (guarded by passes_lock). */
+    pthread_mutex_t passes_lock;
+    pthread_cond_t passed;
+    unsigned long passes;
+} ec_log = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .passes_lock = PTHREAD_MUTEX_INITIALIZER,
+    .passed = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread struct ec_log_ring *ec_log_ring;
+
+/* Called when a thread with a ring exits. */
+static void
+ec_log_orphan(void *arg)
+{
+    struct ec_log_ring *ring = arg;
+
+    if (ring->stream != NULL) fclose(ring->stream);
+
+    pthread_mutex_lock(&ec_log.lock);
+
+    if (ec_log.running) {
+        ring->orphaned = 1;
+        pthread_mutex_unlock(&ec_log.lock);
+        return;
+    }
+
+    /* Nothing will drain it. */
+    for (struct ec_log_ring **r = &ec_log.rings; *r != NULL; r = &(*r)->next) {
+        if (*r == ring) {
+            *r = ring->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ec_log.lock);
+
+    free(ring);
+}
+
+/* The writer doesn't survive a fork, so the child logs to stderr. */
+static void
+ec_log_fork_prepare()
+{
+    pthread_mutex_lock(&ec_log.lock);
+    pthread_mutex_lock(&ec_log.passes_lock);
+}
+
+static void
+ec_log_fork_parent()
+{
+    pthread_mutex_unlock(&ec_log.passes_lock);
+    pthread_mutex_unlock(&ec_log.lock);
+}
+
+static void
+ec_log_fork_child()
+{
+    ec_log.running = 0;
+    ec_log_fork_parent();
+}
+
+static void
+ec_log_init()
+{
+    ec_log.key_ok = pthread_key_create(&ec_log.key, ec_log_orphan) == 0;
+    sem_init(&ec_log.wake, 0, 0);
+    pthread_atfork(ec_log_fork_prepare, ec_log_fork_parent, ec_log_fork_child);
+}
+
+/* Returns the calling thread's ring (NULL if it can't be allocated). */
+static struct ec_log_ring *
+ec_log_ring_get()
+{
+    if (ec_log_ring != NULL) return ec_log_ring;
+
+    struct ec_log_ring *ring = NULL;
+    if (!ec_log.key_ok ||
+        posix_memalign((void **)&ring, EC_LOG_LINE, sizeof(*ring)) != 0) {
+        return NULL;
+    }
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->orphaned = 0;
+
+    /* Kept open, a stream per record costs more than formatting it. */
+    ring->stream = fmemopen(ring->record, sizeof(ring->record), "w");
+    if (ring->stream != NULL) setvbuf(ring->stream, NULL, _IONBF, 0);
+
+    pthread_mutex_lock(&ec_log.lock);
+    ring->next = ec_log.rings;
+    ec_log.rings = ring;
+    pthread_mutex_unlock(&ec_log.lock);
+
+    pthread_setspecific(ec_log.key, ring);
+    ec_log_ring = ring;
+
+    return ring;
+}
+
+/* Returns the calling thread's ring if the sink is started. */
+static struct ec_log_ring *
+ec_log_ring_started()
+{
+    if (!__atomic_load_n(&ec_log.running, __ATOMIC_ACQUIRE)) return NULL;
+    return ec_log_ring_get();
+}
+
+/* Wakes the writer if it is sleeping. */
+static void
+ec_log_wake()
+{
+    if (__atomic_load_n(&ec_log.sleeping, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ec_log.sleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&ec_log.wake);
+    }
+}
+
+/* Writes all of the vectors to fd (dropping them on errors other than
+ * EINTR).
+ */
+static void
+ec_log_writev(int fd, struct iovec *iov, int len)
+{
+    while (len > 0) {
+        ssize_t written = writev(fd, iov, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        while (len > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            len--;
+        }
+
+        if (len > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/* Writes out the records published so far. Returns non-zero if there were
+ * any.
+ */
+static int
+ec_log_pass()
+{
+    struct iovec iov[EC_LOG_BATCH * 2];
+    struct ec_log_ring *rings[EC_LOG_BATCH];
+    size_t heads[EC_LOG_BATCH];
+    int found = 0;
+
+    pthread_mutex_lock(&ec_log.lock);
+
+    struct ec_log_ring **r = &ec_log.rings;
+    while (*r != NULL) {
+        int len = 0;
+        int iov_len = 0;
+
+        for (; *r != NULL && len < EC_LOG_BATCH;) {
+            struct ec_log_ring *ring = *r;
+            size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            size_t tail = ring->tail;
+
+            if (head == tail) {
+                if (ring->orphaned) {
+                    *r = ring->next;
+                    free(ring);
+                    continue;
+                }
+
+                r = &ring->next;
+                continue;
+            }
+
+            size_t start = tail % EC_LOG_RING_SIZE;
+            size_t size = head - tail;
+            size_t first = EC_LOG_RING_SIZE - start;
+            if (first > size) first = size;
+
+            iov[iov_len].iov_base = ring->data + start;
+            iov[iov_len].iov_len = first;
+            iov_len++;
+
+            if (first < size) {
+                iov[iov_len].iov_base = ring->data;
+                iov[iov_len].iov_len = size - first;
+                iov_len++;
+            }
+
+            rings[len] = ring;
+            heads[len] = head;
+            len++;
+
+            r = &ring->next;
+        }
+
+        if (len == 0) break;
+        found = 1;
+
+        /* Rings are only freed by this thread, so the lock isn't needed while
+         * writing.
+         */
+        pthread_mutex_unlock(&ec_log.lock);
+
+        ec_log_writev(ec_log.fd, iov, iov_len);
+
+        for (int i = 0; i < len; i++) {
+            __atomic_store_n(&rings[i]->tail, heads[i], __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_lock(&ec_log.lock);
+    }
+
+    pthread_mutex_unlock(&ec_log.lock);
+
+    pthread_mutex_lock(&ec_log.passes_lock);
+    ec_log.passes++;
+    pthread_cond_broadcast(&ec_log.passed);
+    pthread_mutex_unlock(&ec_log.passes_lock);
+
+    return found;
+}
+
+/* Returns non-zero if any ring has unwritten records. */
+static int
+ec_log_pending()
+{
+    int pending = 0;
+
+    pthread_mutex_lock(&ec_log.lock);
+    for (struct ec_log_ring *ring = ec_log.rings; ring != NULL; ring = ring->next) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail) {
+            pending = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ec_log.lock);
+
+    return pending;
+}
+
+static void *
+ec_log_writer(void *arg)
+{
+    (void)arg;
+
+    unsigned int idle = 0;
+
+    for (;;) {
+        if (ec_log_pass()) {
+            idle = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&ec_log.stopping, __ATOMIC_ACQUIRE)) break;
+
+        /* Records tend to come in bursts (one per frame of an unwind, or per
+         * thread caught up in the same failure), so look again a few times
+         * before paying for a wake.
+         */
+        if (idle++ < EC_LOG_SPINS) {
+            sched_yield();
+            continue;
+        }
+        idle = 0;
+
+        __atomic_store_n(&ec_log.sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (ec_log_pending() ||
+            __atomic_load_n(&ec_log.stopping, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&ec_log.sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        while (sem_wait(&ec_log.wake) != 0 && errno == EINTR);
+        __atomic_store_n(&ec_log.sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+void
+ec_log_start(int fd)
+{
+    pthread_once(&ec_log.once, ec_log_init);
+
+    pthread_mutex_lock(&ec_log.lock);
+
+    if (ec_log.running) {
+        pthread_mutex_unlock(&ec_log.lock);
+        return;
+    }
+
+    ec_log.fd = fd;
+    ec_log.stopping = 0;
+
+    int status = pthread_create(&ec_log.thread, NULL, ec_log_writer, NULL);
+    if (status == 0) {
+        __atomic_store_n(&ec_log.running, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&ec_log.lock);
+
+    if (status != 0) {
+        ec_throw_errno(status, NULL) NULL;
+    }
+}
+
+void
+ec_log_stop()
+{
+    pthread_mutex_lock(&ec_log.lock);
+
+    if (!ec_log.running) {
+        pthread_mutex_unlock(&ec_log.lock);
+        return;
+    }
+
+    __atomic_store_n(&ec_log.stopping, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ec_log.lock);
+
+    sem_post(&ec_log.wake);
+    pthread_join(ec_log.thread, NULL);
+
+    /* Takes over from the writer for anything published while it was
+     * stopping (records logged after this are held until the next start).
+     * The last pass finds nothing and frees the orphaned rings.
+     */
+    while (ec_log_pass());
+
+    pthread_mutex_lock(&ec_log.lock);
+    __atomic_store_n(&ec_log.running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ec_log.lock);
+
+    pthread_mutex_lock(&ec_log.passes_lock);
+    pthread_cond_broadcast(&ec_log.passed);
+    pthread_mutex_unlock(&ec_log.passes_lock);
+
+    /* Drain any leftover wakes. */
+    while (sem_trywait(&ec_log.wake) == 0);
+    ec_log.sleeping = 0;
+}
+
+void
+ec_log_flush()
+{
+    if (!__atomic_load_n(&ec_log.running, __ATOMIC_ACQUIRE)) return;
+
+    /* A pass that was already under way may have missed the records, the one
+     * after it won't.
+     */
+    pthread_mutex_lock(&ec_log.passes_lock);
+
+    unsigned long passes = ec_log.passes;
+    while (ec_log.passes - passes < 2 &&
+           __atomic_load_n(&ec_log.running, __ATOMIC_ACQUIRE)) {
+        /* Posted with the lock held so the pass can't finish before the
+         * wait.
+         */
+        sem_post(&ec_log.wake);
+        pthread_cond_wait(&ec_log.passed, &ec_log.passes_lock);
+    }
+
+    pthread_mutex_unlock(&ec_log.passes_lock);
+}
+
+void
+ec_log_write(const char *record, size_t len)
+{
+    if (len > EC_LOG_RECORD_MAX) len = EC_LOG_RECORD_MAX;
+
+    struct ec_log_ring *ring = ec_log_ring_started();
+    if (ring == NULL) {
+        fwrite(record, 1, len, stderr);
+        return;
+    }
+
+    size_t head = ring->head;
+    while (head + len - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > EC_LOG_RING_SIZE) {
+        if (!__atomic_load_n(&ec_log.running, __ATOMIC_ACQUIRE)) {
+            fwrite(record, 1, len, stderr);
+            return;
+        }
+
+        sched_yield();
+    }
+
+    size_t start = head % EC_LOG_RING_SIZE;
+    size_t first = EC_LOG_RING_SIZE - start;
+    if (first > len) first = len;
+
+    memcpy(ring->data + start, record, first);
+    memcpy(ring->data, record + first, len - first);
+
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_SEQ_CST);
+
+    ec_log_wake();
+}
+
+/* Formats the current exception into the ring's record, returning its length
+ * (at most limit).
+ */
+static size_t
+ec_log_format(struct ec_log_ring *ring, size_t limit)
+{
+    long len = 0;
+
+    if (ring->stream != NULL) {
+        rewind(ring->stream);
+        ec_fprint(ring->stream);
+        len = ftell(ring->stream);
+        if (len < 0) len = 0;
+    }
+
+    /* fmemopen reserves a byte for the terminator, so a full record may have
+     * been cut short.
+     */
+    if ((size_t)len >= EC_LOG_RECORD_MAX || (size_t)len > limit) {
+        len = limit;
+        memcpy(ring->record + len - 4, "...\n", 4);
+    }
+
+    return len;
+}
+
+void
+ec_log_fprint()
+{
+    struct ec_log_ring *ring = ec_log_ring_started();
+    if (ring == NULL) {
+        ec_fprint(stderr);
+        return;
+    }
+
+    ec_log_write(ring->record, ec_log_format(ring, EC_LOG_RECORD_MAX));
+}
+
+void
+ec_log_uncaught()
+{
+    static const char empty[] = "Error stack empty: Abort!\n";
+    const size_t empty_len = sizeof(empty) - 1;
+
+    struct ec_log_ring *ring = ec_log_ring_started();
+    if (ring == NULL) {
+        ec_fprint(stderr);
+        fputs(empty, stderr);
+        return;
+    }
+
+    size_t len = ec_log_format(ring, EC_LOG_RECORD_MAX - empty_len);
+    memcpy(ring->record + len, empty, empty_len);
+
+    ec_log_write(ring->record, len + empty_len);
+    ec_log_flush();
+}
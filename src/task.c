@@ -0,0 +1,361 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ec/ec.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*** Task Groups
+ *
+ * Each worker owns a deque of tasks: It pushes and pops at the tail (so a
+ * task's subtasks run next, while their data is still warm) and other workers
+ * steal from the head. The deques are guarded by their own locks, the group
+ * lock is only taken to sleep and wake.
+ *
+ ***/
+
+struct ec_task {
+    void (*run)(void *arg);
+    void *arg;
+};
+
+/* A ring buffer of tasks. */
+struct ec_task_deque {
+    pthread_mutex_t lock;
+    struct ec_task *tasks;
+    size_t head;
+    size_t len;
+    size_t cap;
+};
+
+struct ec_task_worker {
+    struct ec_task_group *group;
+    struct ec_task_deque deque;
+    unsigned int index;
+    pthread_t thread;
+};
+
+struct ec_task_group {
+    struct ec_task_worker *workers;
+    unsigned int workers_len;
+
+    /* Where the next task spawned from outside the group is queued. */
+    unsigned int next;
+
+    /* Tasks spawned and not yet finished, queued tasks, and sleeping
+     * workers (all atomic).
+     */
+    size_t pending;
+    size_t queued;
+    unsigned int sleepers;
+
+    /* Set by the first exception, cleared by ec_task_group_join(...). */
+    int cancelled;
+
+    pthread_mutex_t lock;
+
+    /* Signalled when tasks are queued (or the workers are stopping). */
+    pthread_cond_t work;
+
+    /* Signalled when pending reaches 0. */
+    pthread_cond_t done;
+
+    /* Guarded by lock. */
+    struct ec_exception *exception;
+    int stopping;
+};
+
+/* The worker of the calling thread (NULL outside of workers). */
+static __thread struct ec_task_worker *ec_task_self = NULL;
+
+/* Push task at the tail of the deque. Returns 0 if it couldn't be grown. */
+static int
+ec_task_push(struct ec_task_deque *deque, struct ec_task task)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->len == deque->cap) {
+        size_t cap = deque->cap == 0 ? 64 : deque->cap * 2;
+        struct ec_task *tasks = malloc(cap * sizeof(*tasks));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return 0;
+        }
+
+        for (size_t i = 0; i < deque->len; i++) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->cap];
+        }
+        free(deque->tasks);
+
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->cap = cap;
+    }
+
+    deque->tasks[(deque->head + deque->len) % deque->cap] = task;
+    deque->len++;
+
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+/* Take a task from the tail (the owner) or the head (a thief). Returns 0 if
+ * the deque is empty.
+ */
+static int
+ec_task_take(struct ec_task_deque *deque, int steal, struct ec_task *task)
+{
+    int taken = 0;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->len > 0) {
+        if (steal) {
+            *task = deque->tasks[deque->head];
+            deque->head = (deque->head + 1) % deque->cap;
+        }
+        else {
+            *task = deque->tasks[(deque->head + deque->len - 1) % deque->cap];
+        }
+        deque->len--;
+        taken = 1;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return taken;
+}
+
+/* Find a task for worker: Its own newest, otherwise the oldest of another. */
+static int
+ec_task_find(struct ec_task_worker *worker, struct ec_task *task)
+{
+    struct ec_task_group *group = worker->group;
+
+    if (__atomic_load_n(&group->queued, __ATOMIC_SEQ_CST) == 0) return 0;
+
+    if (ec_task_take(&worker->deque, 0, task)) return 1;
+
+    for (unsigned int i = 1; i < group->workers_len; i++) {
+        struct ec_task_worker *victim =
+            &group->workers[(worker->index + i) % group->workers_len];
+        if (ec_task_take(&victim->deque, 1, task)) return 1;
+    }
+
+    return 0;
+}
+
+static void
+ec_task_run(struct ec_task_group *group, struct ec_task *task)
+{
+    /* Cancelled tasks are finished without running. */
+    if (!__atomic_load_n(&group->cancelled, __ATOMIC_ACQUIRE)) {
+        /* Volatile as it is live across the ec_try. */
+        struct ec_exception *volatile exception = NULL;
+
+        ec_try {
+            task->run(task->arg);
+        }
+        ec_catch {
+            exception = ec_exception_capture();
+        }
+
+        if (exception != NULL) {
+            pthread_mutex_lock(&group->lock);
+            if (group->exception == NULL) {
+                group->exception = exception;
+                exception = NULL;
+                __atomic_store_n(&group->cancelled, 1, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&group->lock);
+
+            ec_exception_free(exception);
+        }
+    }
+
+    /* Taking the lock orders this against a joiner about to wait. */
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&group->lock);
+        pthread_cond_broadcast(&group->done);
+        pthread_mutex_unlock(&group->lock);
+    }
+}
+
+static void *
+ec_task_worker_main(void *arg)
+{
+    struct ec_task_worker *worker = arg;
+    struct ec_task_group *group = worker->group;
+    struct ec_task task;
+
+    ec_task_self = worker;
+
+    for (;;) {
+        if (ec_task_find(worker, &task)) {
+            __atomic_sub_fetch(&group->queued, 1, __ATOMIC_SEQ_CST);
+            ec_task_run(group, &task);
+            continue;
+        }
+
+        /* Announcing the sleep before checking queued (and spawning
+         * incrementing queued before checking sleepers) means either the
+         * worker sees the task or the spawner sees the sleeper.
+         */
+        pthread_mutex_lock(&group->lock);
+        __atomic_add_fetch(&group->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&group->queued, __ATOMIC_SEQ_CST) == 0 &&
+               !group->stopping) {
+            pthread_cond_wait(&group->work, &group->lock);
+        }
+        __atomic_sub_fetch(&group->sleepers, 1, __ATOMIC_SEQ_CST);
+        int stop = group->stopping &&
+            __atomic_load_n(&group->queued, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&group->lock);
+
+        if (stop) break;
+    }
+
+    return NULL;
+}
+
+/* Stop and join the first started workers and free group. */
+static void
+ec_task_group_stop(struct ec_task_group *group, unsigned int started)
+{
+    pthread_mutex_lock(&group->lock);
+    group->stopping = 1;
+    pthread_cond_broadcast(&group->work);
+    pthread_mutex_unlock(&group->lock);
+
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(group->workers[i].thread, NULL);
+    }
+
+    for (unsigned int i = 0; i < group->workers_len; i++) {
+        pthread_mutex_destroy(&group->workers[i].deque.lock);
+        free(group->workers[i].deque.tasks);
+    }
+
+    ec_exception_free(group->exception);
+
+    pthread_cond_destroy(&group->done);
+    pthread_cond_destroy(&group->work);
+    pthread_mutex_destroy(&group->lock);
+
+    free(group->workers);
+    free(group);
+}
+
+struct ec_task_group *
+ec_task_group_new(unsigned int workers)
+{
+    if (workers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = online > 0 ? (unsigned int)online : 1;
+    }
+
+    struct ec_task_group *group = calloc(1, sizeof(*group));
+    if (group != NULL) {
+        group->workers = calloc(workers, sizeof(*group->workers));
+    }
+    if (group == NULL || group->workers == NULL) {
+        free(group);
+        ec_throw_str_static(ECX_ENOMEM, "Failed to allocate the task group.");
+    }
+
+    group->workers_len = workers;
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->work, NULL);
+    pthread_cond_init(&group->done, NULL);
+
+    for (unsigned int i = 0; i < workers; i++) {
+        group->workers[i].group = group;
+        group->workers[i].index = i;
+        pthread_mutex_init(&group->workers[i].deque.lock, NULL);
+    }
+
+    for (unsigned int i = 0; i < workers; i++) {
+        int error = pthread_create(
+                &group->workers[i].thread, NULL,
+                ec_task_worker_main, &group->workers[i]);
+        if (error != 0) {
+            ec_task_group_stop(group, i);
+            ec_throw_errno(error, NULL) NULL;
+        }
+    }
+
+    return group;
+}
+
+void
+ec_task_group_spawn(
+        struct ec_task_group *group,
+        void (*task)(void *arg),
+        void *arg)
+{
+    struct ec_task_worker *worker = ec_task_self;
+
+    if (worker == NULL || worker->group != group) {
+        unsigned int next = __atomic_fetch_add(&group->next, 1, __ATOMIC_RELAXED);
+        worker = &group->workers[next % group->workers_len];
+    }
+
+    /* Counted first so the group can't appear finished while it is queued. */
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+
+    if (!ec_task_push(&worker->deque, (struct ec_task){ .run = task, .arg = arg })) {
+        __atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+        ec_throw_str_static(ECX_ENOMEM, "Failed to queue the task.");
+    }
+
+    __atomic_add_fetch(&group->queued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&group->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&group->lock);
+        pthread_cond_signal(&group->work);
+        pthread_mutex_unlock(&group->lock);
+    }
+}
+
+struct ec_exception *
+ec_task_group_join(struct ec_task_group *group)
+{
+    pthread_mutex_lock(&group->lock);
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_wait(&group->done, &group->lock);
+    }
+
+    struct ec_exception *exception = group->exception;
+    group->exception = NULL;
+    __atomic_store_n(&group->cancelled, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&group->lock);
+
+    return exception;
+}
+
+void
+ec_task_group_free(struct ec_task_group *group)
+{
+    if (group == NULL) return;
+
+    ec_exception_free(ec_task_group_join(group));
+    ec_task_group_stop(group, group->workers_len);
+}
@@ -0,0 +1,109 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ec/ec.h>
+
+#ifndef DO_MAX
+#define DO_MAX 16
+#endif
+
+/* Counts heap allocations by interposing the allocator. The executable's
+ * definitions take precedence over libc's for every shared object, including
+ * libec.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t allocs = 0;
+static size_t frees = 0;
+
+void *malloc(size_t size) { allocs++; return __libc_malloc(size); }
+void *calloc(size_t nmemb, size_t size) { allocs++; return __libc_calloc(nmemb, size); }
+void *realloc(void *ptr, size_t size) { allocs++; return __libc_realloc(ptr, size); }
+void free(void *ptr) { if (ptr != NULL) frees++; __libc_free(ptr); }
+
+static void
+throw_catch()
+{
+    const char *e = NULL;
+
+    ec_try {
+        ec_throw_str_static(ECX_EC, "Woops!");
+    }
+    ec_catch_a(ECX_EC, e) { }
+    ec_catch { }
+}
+
+static void
+throw_fmt_catch()
+{
+    const struct ec_fmt *f = NULL;
+
+    ec_try {
+        ec_throw_fmt(ECX_EC, "Woops %d in %s!", 42, "here");
+    }
+    ec_catch_a(ECX_EC, f) { }
+    ec_catch { }
+}
+
+static int
+count(const char *name, void (*cycle)(), size_t max)
+{
+    /* Warm up (lazy binding and the like). */
+    cycle();
+
+    size_t start_allocs = allocs, start_frees = frees;
+    for (size_t i = 0; i < max; i++) {
+        cycle();
+    }
+    size_t cycle_allocs = allocs - start_allocs, cycle_frees = frees - start_frees;
+
+    printf("%s:\n", name);
+    printf("  throw->catch cycles = %zu\n", max);
+    printf("  allocations         = %zu\n", cycle_allocs);
+    printf("  frees               = %zu\n", cycle_frees);
+
+    return cycle_allocs == 0 && cycle_frees == 0;
+}
+
+int main()
+{
+    size_t max = 1;
+    max <<= DO_MAX;
+
+    /* Forking isn't what is being counted here. */
+    ec_core_policy(EC_CORE_OFF, 0);
+
+    int ok = count("ec_throw_str_static", throw_catch, max);
+    ok &= count("ec_throw_fmt", throw_fmt_catch, max);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#else
+int main()
+{
+    printf("Allocation counting requires glibc.\n");
+    return 0;
+}
+#endif
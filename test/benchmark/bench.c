@@ -0,0 +1,358 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <ec/ec.h>
+
+#include "harness.h"
+
+/* Microbenchmarks of each primitive. The build flavor (EC_INLINE, EC_FASTJMP)
+ * is fixed at compile time, so there is one of these per flavor. Compare them
+ * (or two builds of the library) with -C.
+ */
+
+#if defined(EC_INLINE) && defined(EC_FASTJMP)
+#define FLAVOR "inline-fastjmp"
+#elif defined(EC_INLINE)
+#define FLAVOR "inline"
+#elif defined(EC_FASTJMP)
+#define FLAVOR "fastjmp"
+#else
+#define FLAVOR "shared"
+#endif
+
+static volatile size_t sink;
+
+static void
+dec(size_t *i)
+{
+    *i = *i - 1;
+}
+
+static __attribute__((noinline)) void
+inc(size_t *i)
+{
+    *i = *i + 1;
+    sink = *i;
+}
+
+static __attribute__((noinline)) void
+thrower()
+{
+    ec_throw_str_static(ECX_EC, "Woops!");
+}
+
+static void
+try(size_t n, void *arg)
+{
+    size_t i = 0;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            inc(&i);
+        }
+        ec_catch { }
+    }
+}
+
+static void
+try_nosig(size_t n, void *arg)
+{
+    size_t i = 0;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_try_nosig {
+            inc(&i);
+        }
+        ec_catch { }
+    }
+}
+
+static void
+try_throw(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            thrower();
+        }
+        ec_catch { }
+    }
+}
+
+static void
+try_throw_nosig(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try_nosig {
+            thrower();
+        }
+        ec_catch { }
+    }
+}
+
+/* The iterations of rate(...) so far. It is kept across calls so that the
+ * rate doesn't depend on how many iterations the harness runs at a time.
+ */
+static size_t rate_iterations;
+
+/* An ec_try around a call which throws on the given number of iterations in
+ * every 1000, spread out evenly (the rate-* cases are named by the
+ * percentage).
+ */
+static void
+rate(size_t n, void *arg)
+{
+    size_t permille = (size_t)arg;
+    size_t i = 0;
+
+    while (n-- > 0) {
+        size_t iteration = rate_iterations++;
+
+        ec_try {
+            if (iteration * permille % 1000 < permille) {
+                thrower();
+            }
+            inc(&i);
+        }
+        ec_catch { }
+    }
+}
+
+static void
+with(size_t n, void *arg)
+{
+    size_t i = 0, *ip = &i;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with(ip, (void (*)(void *))dec) {
+            inc(ip);
+        }
+    }
+}
+
+static void
+with_on_x(size_t n, void *arg)
+{
+    size_t i = 0, *ip = &i;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with_on_x(ip, (void (*)(void *))dec) {
+            inc(ip);
+        }
+    }
+}
+
+static void
+with_free_call(size_t n, void *arg)
+{
+    void *p = NULL;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with(p, free) {
+            sink = (size_t)p;
+        }
+    }
+}
+
+static void
+with_free(size_t n, void *arg)
+{
+    void *p = NULL;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with_free(p) {
+            sink = (size_t)p;
+        }
+    }
+}
+
+static void
+with_5(size_t n, void *arg)
+{
+    size_t i = 0, *ip = &i;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with(ip, (void (*)(void *))dec)
+        ec_with(ip, (void (*)(void *))dec)
+        ec_with(ip, (void (*)(void *))dec)
+        ec_with(ip, (void (*)(void *))dec)
+        ec_with(ip, (void (*)(void *))dec) {
+            inc(ip);
+        }
+    }
+}
+
+static void
+scope_5(size_t n, void *arg)
+{
+    size_t i = 0;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_scope {
+            ec_defer(&i, dec);
+            ec_defer(&i, dec);
+            ec_defer(&i, dec);
+            ec_defer(&i, dec);
+            ec_defer(&i, dec);
+            inc(&i);
+        }
+    }
+}
+
+static void
+malloc_5(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_scope {
+            for (int j = 0; j < 5; j++) {
+                void *p = malloc(64);
+                if (p == NULL) ec_throw_errno(ENOMEM, NULL) NULL;
+                ec_defer(p, free);
+                sink = (size_t)p;
+            }
+        }
+    }
+}
+
+static void
+arena_5(size_t n, void *arg)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(0);
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_with_arena(&arena) {
+            for (int j = 0; j < 5; j++) {
+                sink = (size_t)ec_arena_alloc(&arena, 64);
+            }
+        }
+    }
+
+    ec_arena_release(&arena);
+}
+
+static void
+context_switch(size_t n, void *arg)
+{
+    struct ec_context *a = ec_context_new(), *b = ec_context_new();
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_context_switch(a, b);
+        ec_context_switch(b, a);
+    }
+
+    ec_context_free(a);
+    ec_context_free(b);
+}
+
+static void
+shadow(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            ec_shadow_on_x(ECX_EC, ECX_EINVAL) {
+                thrower();
+            }
+        }
+        ec_catch { }
+    }
+}
+
+static void
+rethrow(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            ec_try {
+                thrower();
+            }
+            ec_catch {
+                ec_rethrow;
+            }
+        }
+        ec_catch { }
+    }
+}
+
+static void
+nested_try(size_t n, void *arg)
+{
+    size_t i = 0;
+
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            ec_try {
+                inc(&i);
+            }
+            ec_catch { }
+        }
+        ec_catch { }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct harness h;
+
+    int status = harness_init(&h, FLAVOR, argc, argv);
+    if (status >= 0) return status;
+
+    /* Measure the throws, not fork(). */
+    ec_core_policy(EC_CORE_OFF, 0);
+
+    harness_run(&h, "try", try, NULL);
+    harness_run(&h, "try-nosig", try_nosig, NULL);
+    harness_run(&h, "try-throw", try_throw, NULL);
+    harness_run(&h, "try-throw-nosig", try_throw_nosig, NULL);
+    harness_run(&h, "rate-0", rate, (void *)0);
+    harness_run(&h, "rate-0.1", rate, (void *)1);
+    harness_run(&h, "rate-1", rate, (void *)10);
+    harness_run(&h, "rate-5", rate, (void *)50);
+    harness_run(&h, "rate-10", rate, (void *)100);
+    harness_run(&h, "with", with, NULL);
+    harness_run(&h, "with-on-x", with_on_x, NULL);
+    harness_run(&h, "with-free-call", with_free_call, NULL);
+    harness_run(&h, "with-free", with_free, NULL);
+    harness_run(&h, "with-5", with_5, NULL);
+    harness_run(&h, "scope-5", scope_5, NULL);
+    harness_run(&h, "malloc-5", malloc_5, NULL);
+    harness_run(&h, "arena-5", arena_5, NULL);
+    harness_run(&h, "context-switch", context_switch, NULL);
+    harness_run(&h, "shadow", shadow, NULL);
+    harness_run(&h, "rethrow", rethrow, NULL);
+    harness_run(&h, "nested-try", nested_try, NULL);
+
+    return harness_finish(&h);
+}
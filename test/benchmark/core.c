@@ -0,0 +1,97 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <ec/ec.h>
+
+#ifndef DO_MAX
+#define DO_MAX 16
+#endif
+
+/* The child of a dump aborts. Don't litter the disk with cores while timing
+ * the fork().
+ */
+static void
+no_cores()
+{
+    struct rlimit limit = { .rlim_cur = 0, .rlim_max = 0 };
+    setrlimit(RLIMIT_CORE, &limit);
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+throws(size_t max)
+{
+    for (size_t i = 0; i < max; i++) {
+        ec_try {
+            ec_throw_str_static(ECX_EAGAIN, "Try again.");
+        }
+        ec_catch { }
+    }
+}
+
+static void
+measure(const char *name, size_t max)
+{
+    double start = now();
+    throws(max);
+    double end = now();
+
+    printf("%-24s %12zu throws %12.1f ns/throw\n", name, max, (end - start) / max);
+}
+
+int main()
+{
+    size_t max = 1;
+    max <<= DO_MAX;
+
+    no_cores();
+
+    ec_core_policy(EC_CORE_ALWAYS, 0);
+    measure("always", max >> 6);
+
+    ec_core_policy(EC_CORE_OFF, 0);
+    measure("off", max);
+
+    ec_core_policy(EC_CORE_FIRST_N, 8);
+    measure("first-n (8)", max);
+
+    ec_core_policy(EC_CORE_SAMPLE, 1024);
+    measure("sample (1/1024)", max);
+
+    ec_core_policy(EC_CORE_RATE, 10);
+    measure("rate (10/s)", max);
+
+    ec_core_policy(EC_CORE_ALWAYS, 0);
+    ec_core_type(ECX_EAGAIN, 0);
+    measure("type (EAGAIN off)", max);
+    ec_core_type(ECX_EAGAIN, -1);
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ec/ec.h>
+
+#include "harness.h"
+
+/* Cost of a throw against the number of frames and the number of windings
+ * between it and the catch, next to the same failure propagated by returning
+ * an error code. Each result is named case/n.
+ *
+ *  throw-depth         Throw n frames below the ec_try.
+ *  errcode-depth       Return an error through n frames (each checks it).
+ *  throw-windings      Throw n frames below the ec_try with an ec_with(...)
+ *                      in each frame (n unwind actions run).
+ *  errcode-cleanup     Return an error through n frames, each calling a
+ *                      cleanup function through a pointer on the way out.
+ */
+
+static volatile size_t sink;
+
+static void
+cleanup(size_t *i)
+{
+    sink = *i;
+}
+
+static void (*volatile cleanup_f)(size_t *) = cleanup;
+
+static __attribute__((noinline)) void
+thrower()
+{
+    ec_throw_str_static(ECX_EINVAL, "Bad input.");
+}
+
+static __attribute__((noinline)) void
+descend(size_t depth)
+{
+    if (depth == 0) thrower();
+    else descend(depth - 1);
+
+    /* Not reached, but keeps the call from being a tail call. */
+    sink = depth;
+}
+
+static __attribute__((noinline)) int
+descend_errcode(size_t depth)
+{
+    if (depth == 0) return EINVAL;
+
+    int status = descend_errcode(depth - 1);
+    if (status != 0) return status;
+
+    sink = depth;
+    return 0;
+}
+
+static __attribute__((noinline)) void
+descend_windings(size_t depth)
+{
+    size_t i = depth, *ip = &i;
+
+    if (depth == 0) thrower();
+
+    ec_with(ip, (void (*)(void *))cleanup) {
+        descend_windings(depth - 1);
+    }
+
+    sink = depth;
+}
+
+static __attribute__((noinline)) int
+descend_cleanup(size_t depth)
+{
+    size_t i = depth;
+
+    if (depth == 0) return EINVAL;
+
+    int status = descend_cleanup(depth - 1);
+    cleanup_f(&i);
+    if (status != 0) return status;
+
+    sink = depth;
+    return 0;
+}
+
+static void
+throw_depth(size_t n, void *arg)
+{
+    size_t depth = (uintptr_t)arg;
+
+    while (n-- > 0) {
+        ec_try_nosig {
+            descend(depth);
+        }
+        ec_catch { }
+    }
+}
+
+static void
+errcode_depth(size_t n, void *arg)
+{
+    size_t depth = (uintptr_t)arg;
+
+    while (n-- > 0) {
+        if (descend_errcode(depth) != 0) sink = 0;
+    }
+}
+
+static void
+throw_windings(size_t n, void *arg)
+{
+    size_t depth = (uintptr_t)arg;
+
+    while (n-- > 0) {
+        ec_try_nosig {
+            descend_windings(depth);
+        }
+        ec_catch { }
+    }
+}
+
+static void
+errcode_cleanup(size_t n, void *arg)
+{
+    size_t depth = (uintptr_t)arg;
+
+    while (n-- > 0) {
+        if (descend_cleanup(depth) != 0) sink = 0;
+    }
+}
+
+static void
+sweep(struct harness *h, const char *name, void (*run)(size_t n, void *arg))
+{
+    static const size_t depths[] = {1, 10, 100, 1000, 10000};
+
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s/%zu", name, depths[i]);
+
+        harness_run(h, label, run, (void *)(uintptr_t)depths[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct harness h;
+
+    int status = harness_init(&h, "depth", argc, argv);
+    if (status >= 0) return status;
+
+    ec_core_policy(EC_CORE_OFF, 0);
+
+    sweep(&h, "throw-depth", throw_depth);
+    sweep(&h, "errcode-depth", errcode_depth);
+    sweep(&h, "throw-windings", throw_windings);
+    sweep(&h, "errcode-cleanup", errcode_cleanup);
+
+    return harness_finish(&h);
+}
@@ -0,0 +1,390 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "harness.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void
+harness_usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-f text|csv|json] [-n samples] [-s ns] [-w ms] [-c cpu]\n"
+            "       %*s [-r name[,name...]] [-T threads]\n"
+            "       %s -C old.csv new.csv [-t percent]\n",
+            name, (int)strlen(name), "", name);
+}
+
+double
+harness_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void
+harness_pin(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (cpu < 0) return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+static void
+harness_cpus(struct harness *h)
+{
+    h->cpus_len = 0;
+
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && h->cpus_len < 256; cpu++) {
+            if (CPU_ISSET(cpu, &set)) h->cpus[h->cpus_len++] = cpu;
+        }
+    }
+#endif
+
+    if (h->cpus_len == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        h->cpus[0] = -1;
+        h->cpus_len = 1;
+        h->threads = online > 0 ? (size_t)online : 1;
+    }
+    else {
+        h->threads = h->cpus_len;
+    }
+}
+
+/*** Compare ***/
+
+#define HARNESS_COMPARE_MAX 256
+
+struct harness_row {
+    char name[64];
+    double p50;
+};
+
+static size_t
+harness_read_csv(const char *path, struct harness_row *rows)
+{
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL) {
+        perror(path);
+        exit(2);
+    }
+
+    char line[512];
+    size_t len = 0;
+    while (len < HARNESS_COMPARE_MAX && fgets(line, sizeof(line), stream) != NULL) {
+        /* name,samples,batch,min,p50,... (the header doesn't parse). */
+        char *comma = strchr(line, ',');
+        if (comma == NULL || (size_t)(comma - line) >= sizeof(rows[len].name)) continue;
+
+        size_t samples, batch;
+        double min, p50;
+        if (sscanf(comma + 1, "%zu,%zu,%lf,%lf", &samples, &batch, &min, &p50) != 4) continue;
+
+        memcpy(rows[len].name, line, comma - line);
+        rows[len].name[comma - line] = '\0';
+        rows[len].p50 = p50;
+        len++;
+    }
+
+    fclose(stream);
+    return len;
+}
+
+static int
+harness_compare(const char *old_path, const char *new_path, double threshold)
+{
+    static struct harness_row old_rows[HARNESS_COMPARE_MAX];
+    static struct harness_row new_rows[HARNESS_COMPARE_MAX];
+
+    size_t old_len = harness_read_csv(old_path, old_rows);
+    size_t new_len = harness_read_csv(new_path, new_rows);
+    int regressions = 0;
+
+    printf("%-28s %12s %12s %9s\n", "name", "old p50", "new p50", "change");
+    for (size_t i = 0; i < new_len; i++) {
+        size_t j = 0;
+        while (j < old_len && strcmp(old_rows[j].name, new_rows[i].name) != 0) j++;
+
+        if (j == old_len) {
+            printf("%-28s %12s %12.1f %9s\n", new_rows[i].name, "-", new_rows[i].p50, "new");
+            continue;
+        }
+
+        double change = (new_rows[i].p50 / old_rows[j].p50 - 1) * 100;
+        int regressed = change > threshold;
+        regressions += regressed;
+
+        printf("%-28s %12.1f %12.1f %+8.1f%%%s\n",
+                new_rows[i].name, old_rows[j].p50, new_rows[i].p50, change,
+                regressed ? "  REGRESSION" : "");
+    }
+
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*** Options ***/
+
+int
+harness_init(struct harness *h, const char *flavor, int argc, char **argv)
+{
+    const char *compare = NULL;
+    double threshold = 5;
+    int opt;
+
+    h->format = HARNESS_TEXT;
+    h->samples = 200;
+    h->sample_ns = 200000;
+    h->warmup_ns = 50e6;
+    harness_cpus(h);
+    h->cpu = h->cpus[0];
+    h->only = NULL;
+    h->flavor = flavor;
+    h->printed = 0;
+
+    while ((opt = getopt(argc, argv, "f:n:s:w:c:r:T:C:t:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "text") == 0) h->format = HARNESS_TEXT;
+                else if (strcmp(optarg, "csv") == 0) h->format = HARNESS_CSV;
+                else if (strcmp(optarg, "json") == 0) h->format = HARNESS_JSON;
+                else {
+                    harness_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n': h->samples = strtoul(optarg, NULL, 10); break;
+            case 's': h->sample_ns = strtod(optarg, NULL); break;
+            case 'w': h->warmup_ns = strtod(optarg, NULL) * 1e6; break;
+            case 'c': h->cpu = atoi(optarg); break;
+            case 'r': h->only = optarg; break;
+            case 'T': h->threads = strtoul(optarg, NULL, 10); break;
+            case 'C': compare = optarg; break;
+            case 't': threshold = strtod(optarg, NULL); break;
+            default:
+                harness_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (compare != NULL) {
+        if (optind != argc - 1) {
+            harness_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return harness_compare(compare, argv[optind], threshold);
+    }
+
+    if (h->samples == 0) h->samples = 1;
+    if (h->threads == 0) h->threads = 1;
+
+    harness_pin(h->cpu);
+
+    return -1;
+}
+
+int
+harness_selected(struct harness *h, const char *name)
+{
+    if (h->only == NULL) return 1;
+
+    /* A case named base/n is also selected by its base. */
+    size_t len = strlen(name);
+    const char *slash = strchr(name, '/');
+    size_t base = slash != NULL ? (size_t)(slash - name) : len;
+
+    for (const char *s = h->only; *s != '\0';) {
+        const char *end = strchr(s, ',');
+        if (end == NULL) end = s + strlen(s);
+
+        size_t n = end - s;
+        if ((n == len || n == base) && strncmp(s, name, n) == 0) return 1;
+
+        s = *end == ',' ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+/*** Measurement ***/
+
+static int
+harness_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank. */
+static double
+harness_percentile(const double *sorted, size_t len, double p)
+{
+    size_t rank = (size_t)(p / 100 * len + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > len) rank = len;
+    return sorted[rank - 1];
+}
+
+void
+harness_summarize(struct harness_result *result, double *samples, size_t len)
+{
+    double sum = 0;
+
+    qsort(samples, len, sizeof(*samples), harness_cmp);
+    for (size_t i = 0; i < len; i++) sum += samples[i];
+
+    result->samples = len;
+    result->min = samples[0];
+    result->p50 = harness_percentile(samples, len, 50);
+    result->p90 = harness_percentile(samples, len, 90);
+    result->p99 = harness_percentile(samples, len, 99);
+    result->mean = sum / len;
+}
+
+size_t
+harness_calibrate(
+        struct harness *h,
+        void (*run)(size_t n, void *arg),
+        void *arg)
+{
+    /* Warm up (caches, branch predictors, frequency scaling) while finding a
+     * batch size that takes about sample_ns.
+     */
+    size_t batch = 1;
+    double start = harness_now(), elapsed = 0;
+    do {
+        double batch_start = harness_now();
+        run(batch, arg);
+        double batch_ns = harness_now() - batch_start;
+
+        if (batch_ns < h->sample_ns / 2) {
+            batch *= 2;
+        }
+        else if (batch_ns > h->sample_ns * 2 && batch > 1) {
+            batch /= 2;
+        }
+
+        elapsed = harness_now() - start;
+    } while (elapsed < h->warmup_ns);
+
+    return batch;
+}
+
+void
+harness_run(
+        struct harness *h,
+        const char *name,
+        void (*run)(size_t n, void *arg),
+        void *arg)
+{
+    if (!harness_selected(h, name)) return;
+
+    size_t batch = harness_calibrate(h, run, arg);
+
+    double *samples = malloc(h->samples * sizeof(*samples));
+    if (samples == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < h->samples; i++) {
+        double batch_start = harness_now();
+        run(batch, arg);
+        samples[i] = (harness_now() - batch_start) / batch;
+    }
+
+    struct harness_result result = { .name = name, .batch = batch };
+    harness_summarize(&result, samples, h->samples);
+    result.ops = 1e9 / result.mean;
+
+    free(samples);
+
+    harness_print(h, &result);
+}
+
+/*** Output ***/
+
+void
+harness_print(struct harness *h, const struct harness_result *r)
+{
+    switch (h->format) {
+        case HARNESS_TEXT:
+            if (h->printed == 0) {
+                printf("# %s, cpu %d, ns/op\n", h->flavor, h->cpu);
+                printf("%-28s %9s %9s %9s %9s %9s %14s\n",
+                        "name", "min", "p50", "p90", "p99", "mean", "ops/s");
+            }
+            printf("%-28s %9.1f %9.1f %9.1f %9.1f %9.1f %14.0f\n",
+                    r->name, r->min, r->p50, r->p90, r->p99, r->mean, r->ops);
+            break;
+        case HARNESS_CSV:
+            if (h->printed == 0) {
+                printf("name,samples,batch,min,p50,p90,p99,mean,ops\n");
+            }
+            printf("%s,%zu,%zu,%.2f,%.2f,%.2f,%.2f,%.2f,%.0f\n",
+                    r->name, r->samples, r->batch,
+                    r->min, r->p50, r->p90, r->p99, r->mean, r->ops);
+            break;
+        case HARNESS_JSON:
+            if (h->printed == 0) {
+                printf("{\"flavor\": \"%s\", \"cpu\": %d, \"results\": [", h->flavor, h->cpu);
+            }
+            printf("%s\n    {\"name\": \"%s\", \"samples\": %zu, \"batch\": %zu, "
+                   "\"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, "
+                   "\"mean\": %.2f, \"ops\": %.0f}",
+                    h->printed == 0 ? "" : ",",
+                    r->name, r->samples, r->batch,
+                    r->min, r->p50, r->p90, r->p99, r->mean, r->ops);
+            break;
+    }
+
+    h->printed++;
+    fflush(stdout);
+}
+
+int
+harness_finish(struct harness *h)
+{
+    if (h->format == HARNESS_JSON) {
+        if (h->printed == 0) {
+            printf("{\"flavor\": \"%s\", \"cpu\": %d, \"results\": [", h->flavor, h->cpu);
+        }
+        printf("\n]}\n");
+    }
+
+    return EXIT_SUCCESS;
+}
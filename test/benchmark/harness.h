@@ -0,0 +1,129 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H 1
+
+/* Shared driver for the benchmarks: warm-up, CPU pinning, repeated timed
+ * batches summarized as percentiles of ns/op, and text, CSV, or JSON output.
+ * A compare mode reads two CSV outputs and flags regressions.
+ *
+ * Options (see harness_usage()):
+ *
+ *  -f text|csv|json    Output format (text).
+ *  -n samples          Timed batches per case (200).
+ *  -s ns               Target time of a batch (200000).
+ *  -w ms               Warm-up per case (50).
+ *  -c cpu              CPU to pin to (-1 for none, the default is the first
+ *                      CPU the process may run on).
+ *  -r name[,name...]   Only run the named cases (a name without a /n suffix
+ *                      selects all of base/n).
+ *  -T threads          Most threads to use in multi-threaded cases (the
+ *                      number of CPUs the process may run on).
+ *  -C old.csv new.csv  Compare two runs instead (exits 1 on a regression).
+ *  -t percent          Regression threshold for -C (5).
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum harness_format {
+    HARNESS_TEXT,
+    HARNESS_CSV,
+    HARNESS_JSON,
+};
+
+struct harness_result {
+    const char *name;
+
+    /* Timed batches and operations per batch. */
+    size_t samples;
+    size_t batch;
+
+    /* ns/op over the batches. */
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double mean;
+
+    /* Operations per second (aggregate for multi-threaded cases). */
+    double ops;
+};
+
+struct harness {
+    enum harness_format format;
+    size_t samples;
+    double sample_ns;
+    double warmup_ns;
+    int cpu;
+    const char *only;
+    size_t threads;
+
+    /* The CPUs the process could run on before it was pinned. */
+    int cpus[256];
+    size_t cpus_len;
+
+    /* Build flavor printed with the results (e.g. "inline"). */
+    const char *flavor;
+
+    /* Results printed so far. */
+    size_t printed;
+};
+
+/* Parse the options. Returns -1 if the benchmarks should be run, otherwise
+ * the exit status (after running the compare mode or printing the usage).
+ */
+int harness_init(struct harness *h, const char *flavor, int argc, char **argv);
+
+/* Returns 1 if the named case was selected (-r). */
+int harness_selected(struct harness *h, const char *name);
+
+/* Monotonic time in ns. */
+double harness_now();
+
+/* Pin the calling thread to the CPU (ignored if cpu is negative). */
+void harness_pin(int cpu);
+
+/* Warm up run(...) and return the number of operations which take about the
+ * target batch time.
+ */
+size_t harness_calibrate(
+        struct harness *h,
+        void (*run)(size_t n, void *arg),
+        void *arg);
+
+/* Fill in the summary of samples (ns/op) in result. The samples are sorted. */
+void harness_summarize(struct harness_result *result, double *samples, size_t len);
+
+/* Warm up, size the batches, time them, and print the result. run(n, arg)
+ * must perform n operations.
+ */
+void harness_run(
+        struct harness *h,
+        const char *name,
+        void (*run)(size_t n, void *arg),
+        void *arg);
+
+/* Print a result measured by the caller. */
+void harness_print(struct harness *h, const struct harness_result *result);
+
+/* Finish the output. Returns the exit status. */
+int harness_finish(struct harness *h);
+
+#endif /* HARNESS_H */
@@ -65,7 +65,7 @@ main()
 
     printf("Reliable lower bounds:\n\n");
 
-    printf("ec_try      = %zu\n", sizeof(sigjmp_buf));
+    printf("ec_try      = %zu\n", sizeof(ec_jmp_buf));
     printf("ec_with     = %zu\n", sizeof(struct ec_winding));
 
     printf("\nComputed stack sizes:\n\n");
@@ -0,0 +1,254 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <ec/ec.h>
+
+#include "harness.h"
+
+/* Throughput of throwing and catching from 1 to -T threads at once (each
+ * pinned to its own CPU where possible), and the cost of short-lived threads
+ * using exceptions. Each result is named case/threads. Its ns/op percentiles
+ * are over the batches of every thread, and its ops/s is the aggregate.
+ *
+ *  throw           Throw and catch (no coredumps).
+ *  throw-fprint    As throw, but also print the exception with ec_fprint(...)
+ *                  to a stream shared by all of the threads.
+ *  throw-log       As throw-fprint, but through the asynchronous sink with
+ *                  ec_log_fprint().
+ *  throw-core      As throw, but with a coredump (fork) on every throw.
+ *  churn-bare      Create and join a thread which does nothing.
+ *  churn-try       ... which enters an ec_try.
+ *  churn-throw     ... which throws and catches an exception.
+ */
+
+/* Shared by the throw-fprint and throw-log threads. */
+static FILE *shared;
+
+static __attribute__((noinline)) void
+thrower()
+{
+    ec_throw_str_static(ECX_EAGAIN, "Try again.");
+}
+
+static void
+throw(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            thrower();
+        }
+        ec_catch { }
+    }
+}
+
+static void
+throw_fprint(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            thrower();
+        }
+        ec_catch {
+            ec_fprint(shared);
+        }
+    }
+}
+
+static void
+throw_log(size_t n, void *arg)
+{
+    (void)arg;
+    while (n-- > 0) {
+        ec_try {
+            thrower();
+        }
+        ec_catch {
+            ec_log_fprint();
+        }
+    }
+}
+
+struct worker {
+    pthread_t thread;
+    pthread_barrier_t *barrier;
+    int cpu;
+
+    void (*run)(size_t n, void *arg);
+    size_t batch;
+    size_t samples_len;
+    double *samples;
+
+    /* When the worker started and finished its batches. */
+    double start;
+    double end;
+};
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *worker = arg;
+
+    harness_pin(worker->cpu);
+    pthread_barrier_wait(worker->barrier);
+
+    worker->start = harness_now();
+    for (size_t i = 0; i < worker->samples_len; i++) {
+        double start = harness_now();
+        worker->run(worker->batch, NULL);
+        worker->samples[i] = (harness_now() - start) / worker->batch;
+    }
+    worker->end = harness_now();
+
+    return NULL;
+}
+
+static void
+scale(struct harness *h, const char *name, void (*run)(size_t n, void *arg))
+{
+    if (!harness_selected(h, name)) return;
+
+    size_t batch = harness_calibrate(h, run, NULL);
+
+    struct worker *workers = calloc(h->threads, sizeof(*workers));
+    double *samples = calloc(h->threads * h->samples, sizeof(*samples));
+    if (workers == NULL || samples == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t threads = 1;; threads = threads * 2 < h->threads ? threads * 2 : h->threads) {
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, NULL, threads + 1);
+
+        for (size_t i = 0; i < threads; i++) {
+            workers[i] = (struct worker){
+                .barrier = &barrier,
+                .cpu = h->cpus[i % h->cpus_len],
+                .run = run,
+                .batch = batch,
+                .samples_len = h->samples,
+                .samples = &samples[i * h->samples],
+            };
+            pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        }
+
+        pthread_barrier_wait(&barrier);
+
+        double start = 0, end = 0;
+        for (size_t i = 0; i < threads; i++) {
+            pthread_join(workers[i].thread, NULL);
+            if (i == 0 || workers[i].start < start) start = workers[i].start;
+            if (i == 0 || workers[i].end > end) end = workers[i].end;
+        }
+        double elapsed = end - start;
+
+        pthread_barrier_destroy(&barrier);
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s/%zu", name, threads);
+
+        struct harness_result result = { .name = label, .batch = batch };
+        harness_summarize(&result, samples, threads * h->samples);
+        result.ops = threads * h->samples * batch / elapsed * 1e9;
+        harness_print(h, &result);
+
+        if (threads == h->threads) break;
+    }
+
+    free(samples);
+    free(workers);
+}
+
+static void *
+churn_bare_main(void *arg)
+{
+    return arg;
+}
+
+static void *
+churn_try_main(void *arg)
+{
+    ec_try { }
+    ec_catch { }
+    return arg;
+}
+
+static void *
+churn_throw_main(void *arg)
+{
+    throw(1, NULL);
+    return arg;
+}
+
+static void
+churn(size_t n, void *arg)
+{
+    void *(*main)(void *) = (void *(*)(void *))arg;
+
+    while (n-- > 0) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, main, NULL);
+        pthread_join(thread, NULL);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct harness h;
+
+    int status = harness_init(&h, "threads", argc, argv);
+    if (status >= 0) return status;
+
+    shared = fopen("/dev/null", "w");
+    if (shared == NULL) {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+
+    ec_core_policy(EC_CORE_OFF, 0);
+    scale(&h, "throw", throw);
+    scale(&h, "throw-fprint", throw_fprint);
+
+    ec_log_start(fileno(shared));
+    scale(&h, "throw-log", throw_log);
+    ec_log_stop();
+
+    /* The child of a dump aborts. Don't litter the disk with cores. */
+    struct rlimit limit = { .rlim_cur = 0, .rlim_max = 0 };
+    setrlimit(RLIMIT_CORE, &limit);
+
+    ec_core_policy(EC_CORE_ALWAYS, 0);
+    scale(&h, "throw-core", throw);
+    ec_core_policy(EC_CORE_OFF, 0);
+
+    harness_run(&h, "churn-bare/1", churn, (void *)churn_bare_main);
+    harness_run(&h, "churn-try/1", churn, (void *)churn_try_main);
+    harness_run(&h, "churn-throw/1", churn, (void *)churn_throw_main);
+
+    fclose(shared);
+
+    return harness_finish(&h);
+}
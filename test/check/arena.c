@@ -0,0 +1,196 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+START_TEST(arena_alloc)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(256);
+
+    char *a = ec_arena_alloc(&arena, 1);
+    char *b = ec_arena_alloc(&arena, 17);
+    char *c = ec_arena_alloc(&arena, 0);
+
+    fail_unless((uintptr_t)a % EC_ARENA_ALIGN == 0, NULL);
+    fail_unless((uintptr_t)b % EC_ARENA_ALIGN == 0, NULL);
+    fail_unless((uintptr_t)c % EC_ARENA_ALIGN == 0, NULL);
+    fail_unless(b == a + EC_ARENA_ALIGN, NULL);
+    fail_unless(c == b + 2 * EC_ARENA_ALIGN, NULL);
+
+    /* Blocks are added as needed (and larger ones for large allocations). */
+    struct ec_arena_block *first = arena.block;
+    char *d = ec_arena_alloc(&arena, 256);
+    fail_unless(arena.block != first, NULL);
+    fail_unless(arena.block->prev == first, NULL);
+    memset(d, 0xff, 256);
+
+    char *e = ec_arena_alloc(&arena, 4096);
+    fail_unless(arena.block->size >= 4096, NULL);
+    memset(e, 0xff, 4096);
+
+    ec_arena_release(&arena);
+    fail_unless(arena.block == NULL, NULL);
+    fail_unless(arena.spare == NULL, NULL);
+}
+END_TEST
+
+START_TEST(arena_rewind)
+{
+    struct ec_arena arena;
+    ec_arena_init(&arena, 64);
+
+    ec_arena_alloc(&arena, 16);
+    struct ec_arena_mark mark = ec_arena_mark(&arena);
+    char *next = arena.next;
+
+    for (int i = 0; i < 10; i++) {
+        ec_arena_alloc(&arena, 48);
+    }
+    ec_arena_rewind(&mark);
+
+    fail_unless(arena.block == mark.block, NULL);
+    fail_unless(arena.next == next, NULL);
+    fail_unless(arena.spare != NULL, NULL);
+
+    /* The spare block is reused. */
+    struct ec_arena_block *spare = arena.spare;
+    ec_arena_alloc(&arena, 48);
+    ec_arena_alloc(&arena, 48);
+    fail_unless(arena.block == spare, NULL);
+    fail_unless(arena.spare == NULL, NULL);
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
+START_TEST(arena_with)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(64);
+
+    ec_with_arena(&arena) {
+        for (int i = 0; i < 10; i++) {
+            ec_arena_alloc(&arena, 32);
+        }
+    }
+    fail_unless(arena.block == NULL, NULL);
+
+    ec_try {
+        ec_with_arena(&arena) {
+            for (int i = 0; i < 10; i++) {
+                ec_arena_alloc(&arena, 32);
+            }
+            ec_throw_str_static(ECX_EC, "Rewind.");
+        }
+    }
+    ec_catch { }
+    fail_unless(arena.block == NULL, NULL);
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
+START_TEST(arena_with_on_x)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(64);
+    char *kept = NULL;
+
+    /* Kept on success... */
+    ec_with_arena_on_x(&arena) {
+        kept = ec_arena_alloc(&arena, 32);
+    }
+    fail_unless(arena.block != NULL, NULL);
+    fail_unless(arena.next == kept + 32, NULL);
+
+    /* ...but not on an exception (back to where the block started). */
+    ec_try {
+        ec_with_arena_on_x(&arena) {
+            for (int i = 0; i < 10; i++) {
+                ec_arena_alloc(&arena, 32);
+            }
+            ec_throw_str_static(ECX_EC, "Rewind.");
+        }
+    }
+    ec_catch { }
+    fail_unless(arena.next == kept + 32, NULL);
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
+START_TEST(arena_with_nested)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(64);
+
+    ec_with_arena(&arena) {
+        char *outer = ec_arena_alloc(&arena, 32);
+
+        ec_try {
+            ec_with_arena(&arena) {
+                ec_arena_alloc(&arena, 48);
+                ec_arena_alloc(&arena, 48);
+                ec_throw_str_static(ECX_EC, "Inner.");
+            }
+        }
+        ec_catch { }
+
+        fail_unless(arena.next == outer + 32, NULL);
+    }
+    fail_unless(arena.block == NULL, NULL);
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
+Suite *
+arena_suite(void)
+{
+    Suite *s = suite_create("Arena");
+
+    TCase *tc_arena = tcase_create("arena");
+    tcase_add_test(tc_arena, arena_alloc);
+    tcase_add_test(tc_arena, arena_rewind);
+    suite_add_tcase(s, tc_arena);
+
+    TCase *tc_arena_with = tcase_create("with arena");
+    tcase_add_test(tc_arena_with, arena_with);
+    tcase_add_test(tc_arena_with, arena_with_on_x);
+    tcase_add_test(tc_arena_with, arena_with_nested);
+    suite_add_tcase(s, tc_arena_with);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(arena_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
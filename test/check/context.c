@@ -0,0 +1,184 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <ec/ec.h>
+
+#define FIBERS 3
+#define STACK_SIZE (64 * 1024)
+
+struct fiber {
+    ucontext_t uc;
+    struct ec_context *ec;
+    char *stack;
+    int id;
+    int done;
+    int caught;
+    int unwound;
+};
+
+static struct fiber fibers[FIBERS];
+static struct fiber scheduler;
+static struct fiber *current = NULL;
+
+/* Switches from the current fiber to f. */
+static void
+fiber_switch(struct fiber *f)
+{
+    struct fiber *from = current;
+    current = f;
+
+    ec_context_switch(from->ec, f->ec);
+    swapcontext(&from->uc, &f->uc);
+}
+
+static void
+fiber_unwind(struct fiber *f)
+{
+    f->unwound++;
+}
+
+/* Each fiber yields in the middle of an ec_try and an ec_with, then throws. */
+static void
+fiber_main(int i)
+{
+    struct fiber *f = &fibers[i];
+    const char *e = NULL;
+
+    ec_try {
+        ec_with(f, fiber_unwind) {
+            fiber_switch(&scheduler);
+            ec_throw_str_static(ECX_EC, "Fiber.");
+        }
+    }
+    ec_catch_a(ECX_EC, e) {
+        f->caught = 1;
+    }
+    ec_catch { }
+
+    f->done = 1;
+    fiber_switch(&scheduler);
+}
+
+START_TEST(context_new)
+{
+    struct ec_context *saved = ec_context_new();
+    struct ec_context *empty = ec_context_new();
+    volatile int caught = 0;
+
+    ec_try {
+        /* In the new context the outer ec_try isn't visible. */
+        ec_context_switch(saved, empty);
+        fail_unless(ec_env(NULL) == NULL, NULL);
+
+        ec_try {
+            ec_throw_str_static(ECX_EC, "Inner.");
+        }
+        ec_catch {
+            caught = 1;
+        }
+
+        ec_context_switch(empty, saved);
+        fail_unless(ec_env(NULL) != NULL, NULL);
+
+        ec_throw_str_static(ECX_EC, "Outer.");
+    }
+    ec_catch {
+        caught++;
+    }
+    fail_unless(caught == 2, NULL);
+
+    ec_context_free(saved);
+    ec_context_free(empty);
+}
+END_TEST
+
+START_TEST(context_fibers)
+{
+    scheduler.ec = ec_context_new();
+    current = &scheduler;
+
+    for (int i = 0; i < FIBERS; i++) {
+        struct fiber *f = &fibers[i];
+
+        f->ec = ec_context_new();
+        f->stack = malloc(STACK_SIZE);
+        fail_unless(f->stack != NULL, NULL);
+
+        getcontext(&f->uc);
+        f->uc.uc_stack.ss_sp = f->stack;
+        f->uc.uc_stack.ss_size = STACK_SIZE;
+        f->uc.uc_link = NULL;
+        makecontext(&f->uc, (void (*)())fiber_main, 1, i);
+    }
+
+    /* Round robin until all are done (each is suspended inside its ec_try
+     * while the others run).
+     */
+    int done;
+    do {
+        done = 0;
+        for (int i = 0; i < FIBERS; i++) {
+            if (!fibers[i].done) fiber_switch(&fibers[i]);
+            done += fibers[i].done;
+        }
+    } while (done < FIBERS);
+
+    for (int i = 0; i < FIBERS; i++) {
+        fail_unless(fibers[i].caught == 1, NULL);
+        fail_unless(fibers[i].unwound == 1, NULL);
+        ec_context_free(fibers[i].ec);
+        free(fibers[i].stack);
+    }
+    ec_context_free(scheduler.ec);
+
+    /* The scheduler's state is as it was. */
+    fail_unless(ec_env(NULL) == NULL, NULL);
+}
+END_TEST
+
+Suite *
+context_suite(void)
+{
+    Suite *s = suite_create("Context");
+
+    TCase *tc_context = tcase_create("context");
+    tcase_add_test(tc_context, context_new);
+    tcase_add_test(tc_context, context_fibers);
+    suite_add_tcase(s, tc_context);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(context_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+
+#include <ec/ec.h>
+#include <ec/static/ec.h>
+
+START_TEST(core_always)
+{
+    ec_core_policy(EC_CORE_ALWAYS, 0);
+    for (int i = 0; i < 10; i++) {
+        fail_unless(ec_core_check(ECX_EC) == 1, NULL);
+    }
+}
+END_TEST
+
+START_TEST(core_off)
+{
+    ec_core_policy(EC_CORE_OFF, 0);
+    for (int i = 0; i < 10; i++) {
+        fail_unless(ec_core_check(ECX_EC) == 0, NULL);
+    }
+}
+END_TEST
+
+START_TEST(core_first_n)
+{
+    ec_core_policy(EC_CORE_FIRST_N, 3);
+    fail_unless(ec_core_check(ECX_EC) == 1, NULL);
+    fail_unless(ec_core_check(ECX_EIO) == 1, NULL);
+    fail_unless(ec_core_check(ECX_EC) == 1, NULL);
+    fail_unless(ec_core_check(ECX_EC) == 0, NULL);
+    fail_unless(ec_core_check(ECX_EIO) == 0, NULL);
+
+    /* Setting the policy again resets the count. */
+    ec_core_policy(EC_CORE_FIRST_N, 1);
+    fail_unless(ec_core_check(ECX_EC) == 1, NULL);
+    fail_unless(ec_core_check(ECX_EC) == 0, NULL);
+}
+END_TEST
+
+START_TEST(core_sample)
+{
+    int dumps = 0;
+
+    ec_core_policy(EC_CORE_SAMPLE, 4);
+    for (int i = 0; i < 40; i++) {
+        dumps += ec_core_check(ECX_EC);
+    }
+    fail_unless(dumps == 10, NULL);
+}
+END_TEST
+
+START_TEST(core_rate)
+{
+    int dumps = 0;
+
+    ec_core_policy(EC_CORE_RATE, 2);
+    for (int i = 0; i < 100; i++) {
+        dumps += ec_core_check(ECX_EC);
+    }
+
+    /* Allow for crossing into the next second. */
+    fail_unless(dumps >= 2 && dumps <= 4, NULL);
+}
+END_TEST
+
+START_TEST(core_type)
+{
+    ec_core_policy(EC_CORE_OFF, 0);
+    ec_core_type(ECX_EFAULT, 1);
+    fail_unless(ec_core_check(ECX_EFAULT) == 1, NULL);
+    fail_unless(ec_core_check(ECX_EC) == 0, NULL);
+
+    ec_core_policy(EC_CORE_ALWAYS, 0);
+    ec_core_type(ECX_EFAULT, 0);
+    fail_unless(ec_core_check(ECX_EFAULT) == 0, NULL);
+    fail_unless(ec_core_check(ECX_EC) == 1, NULL);
+
+    ec_core_type(ECX_EFAULT, -1);
+    fail_unless(ec_core_check(ECX_EFAULT) == 1, NULL);
+}
+END_TEST
+
+START_TEST(core_type_full)
+{
+    static char types[64];
+    const char *e = NULL;
+    int full = 0;
+
+    ec_try {
+        for (int i = 0; i < 64; i++) {
+            ec_core_type(&types[i], 0);
+        }
+    }
+    ec_catch_a(ECX_ENOBUFS, e) {
+        full = 1;
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+
+    fail_unless(full == 1, NULL);
+}
+END_TEST
+
+Suite *
+core_suite(void)
+{
+    Suite *s = suite_create("Core");
+
+    TCase *tc_policy = tcase_create("Core Policy");
+    tcase_add_test(tc_policy, core_always);
+    tcase_add_test(tc_policy, core_off);
+    tcase_add_test(tc_policy, core_first_n);
+    tcase_add_test(tc_policy, core_sample);
+    tcase_add_test(tc_policy, core_rate);
+    suite_add_tcase(s, tc_policy);
+
+    TCase *tc_type = tcase_create("Core Type");
+    tcase_add_test(tc_type, core_type);
+    tcase_add_test(tc_type, core_type_full);
+    suite_add_tcase(s, tc_type);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(core_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,151 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+/* Prints the current exception with its data printer into buf. */
+static void
+print_data(char *buf, size_t size)
+{
+    FILE *stream = fmemopen(buf, size, "w");
+    fail_unless(stream != NULL, NULL);
+    ec_fprint_errno_str(stream, (char *)ec_get_data());
+    fclose(stream);
+}
+
+START_TEST(errno_captured)
+{
+    char buf[256];
+    const char *e = NULL;
+
+    ec_try {
+        errno = ENOENT;
+
+        /* The data clobbers errno after it was passed in. */
+        ec_throw_errno(errno, NULL) (errno = EBADF, "/no/such/file");
+    }
+    ec_catch_a(ECX_ENOENT, e) {
+        fail_unless(ec_get_errno() == ENOENT, NULL);
+        fail_unless(strcmp(e, "/no/such/file") == 0, NULL);
+
+        errno = EINVAL;
+        print_data(buf, sizeof(buf));
+        fail_unless(strcmp(buf, "No such file or directory: /no/such/file") == 0, NULL);
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+
+    fail_unless(ec_get_errno() == 0, NULL);
+}
+END_TEST
+
+START_TEST(errno_from_type)
+{
+    char buf[256];
+
+    /* Thrown by type, the error number comes from the type. */
+    ec_try {
+        errno = EINVAL;
+        ec_throw(ECX_ENOMEM, NULL, (void (*)(FILE *, void *))ec_fprint_errno_str) NULL;
+    }
+    ec_catch {
+        fail_unless(ec_get_errno() == 0, NULL);
+        print_data(buf, sizeof(buf));
+        fail_unless(strcmp(buf, "Cannot allocate memory") == 0, NULL);
+    }
+
+    /* Otherwise errno is used. */
+    ec_try {
+        errno = EINVAL;
+        ec_throw_str(ECX_EC) NULL;
+    }
+    ec_catch {
+        print_data(buf, sizeof(buf));
+        fail_unless(strcmp(buf, "Invalid argument") == 0, NULL);
+    }
+}
+END_TEST
+
+START_TEST(errno_table)
+{
+    int count = 0;
+
+    for (int error = 0; error < 4096; error++) {
+        const char *type = ec_errno_type(error);
+        if (type == ECX_EC) {
+            fail_unless(ec_errno_name(error) == NULL, NULL);
+            fail_unless(ec_errno_str(error) == NULL, NULL);
+            continue;
+        }
+
+        count++;
+        fail_unless(ec_type_errno(type) == error, NULL);
+        fail_unless(ec_errno_name(error) != NULL, NULL);
+        fail_unless(ec_errno_str(error) != NULL, NULL);
+#ifdef __GLIBC__
+        /* The descriptions are glibc's untranslated ones. */
+        fail_unless(strcmp(ec_errno_str(error), strerror(error)) == 0,
+                ec_errno_name(error));
+#endif
+    }
+    fail_unless(count >= 76, NULL);
+
+    fail_unless(strcmp(ec_errno_name(EACCES), "EACCES") == 0, NULL);
+    fail_unless(ec_type_errno(ECX_EWOULDBLOCK) == EWOULDBLOCK, NULL);
+    fail_unless(ec_type_errno(ECX_EOPNOTSUPP) == EOPNOTSUPP, NULL);
+    fail_unless(ec_type_errno(ECX_EC) == 0, NULL);
+    fail_unless(ec_type_errno("ENOENT") == 0, NULL);
+    fail_unless(ec_type_errno(NULL) == 0, NULL);
+    fail_unless(ec_errno_type(-1) == ECX_EC, NULL);
+}
+END_TEST
+
+Suite *
+errno_suite(void)
+{
+    Suite *s = suite_create("Errno");
+
+    TCase *tc_errno = tcase_create("Errno");
+    tcase_add_test(tc_errno, errno_captured);
+    tcase_add_test(tc_errno, errno_from_type);
+    tcase_add_test(tc_errno, errno_table);
+    suite_add_tcase(s, tc_errno);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(errno_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
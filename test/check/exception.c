@@ -0,0 +1,335 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+static int cleanups = 0;
+
+static void
+count_cleanup(void *data)
+{
+    (void)data;
+    cleanups++;
+}
+
+static unsigned int thrower_line = 0;
+
+static void
+thrower()
+{
+    thrower_line = __LINE__ + 1;
+    ec_throw(ECX_EIO, count_cleanup, NULL) &cleanups;
+}
+
+START_TEST(exception_none)
+{
+    fail_unless(ec_exception_capture() == NULL, NULL);
+
+    /* Does nothing. */
+    ec_exception_free(NULL);
+    ec_exception_rethrow(NULL);
+}
+END_TEST
+
+START_TEST(exception_rethrow)
+{
+    struct ec_exception *exception = NULL;
+    const void *data = NULL;
+
+    cleanups = 0;
+    ec_try {
+        thrower();
+    }
+    ec_catch {
+        exception = ec_exception_capture();
+    }
+    fail_unless(exception != NULL, NULL);
+    fail_unless(ec_exception_type(exception) == ECX_EIO, NULL);
+    fail_unless(cleanups == 0, NULL);
+
+    /* Raised again with the original place. */
+    ec_try {
+        ec_exception_rethrow(exception);
+        fail("Should have been rethrown.");
+    }
+    ec_catch_a(ECX_EIO, data) {
+        fail_unless(data == &cleanups, NULL);
+        fail_unless(strcmp(ec_get_function(), "thrower") == 0, NULL);
+        fail_unless(ec_get_line() == thrower_line, NULL);
+    }
+    ec_catch {
+        fail("Wrong exception type.");
+    }
+    fail_unless(cleanups == 1, NULL);
+}
+END_TEST
+
+START_TEST(exception_free)
+{
+    struct ec_exception *exception = NULL;
+
+    cleanups = 0;
+    ec_try {
+        thrower();
+    }
+    ec_catch {
+        exception = ec_exception_capture();
+    }
+
+    ec_exception_free(exception);
+    fail_unless(cleanups == 1, NULL);
+}
+END_TEST
+
+static void *
+exception_worker(void *arg)
+{
+    struct ec_exception **exception = arg;
+
+    ec_try {
+        ec_throw_fmt(ECX_EINVAL, "Worker %d failed on '%s'.", 3, "input");
+    }
+    ec_catch {
+        *exception = ec_exception_capture();
+    }
+
+    return NULL;
+}
+
+START_TEST(exception_thread)
+{
+    struct ec_exception *exception = NULL;
+    const struct ec_fmt *fmt = NULL;
+    pthread_t thread;
+
+    /* The worker is gone (with its per-thread storage) when rethrown. */
+    fail_unless(pthread_create(&thread, NULL, exception_worker, &exception) == 0, NULL);
+    fail_unless(pthread_join(thread, NULL) == 0, NULL);
+    fail_unless(exception != NULL, NULL);
+
+    int caught = 0;
+    ec_try {
+        ec_exception_rethrow(exception);
+    }
+    ec_catch_a(ECX_EINVAL, fmt) {
+        fail_unless(strcmp(ec_fmt_str(fmt), "Worker 3 failed on 'input'.") == 0, NULL);
+        fail_unless(strcmp(ec_get_function(), "exception_worker") == 0, NULL);
+        caught = 1;
+    }
+    ec_catch { }
+    fail_unless(caught == 1, NULL);
+}
+END_TEST
+
+static int cause_cleanups = 0;
+
+static void
+cause_cleanup(void *data)
+{
+    (void)data;
+    cause_cleanups++;
+}
+
+static void
+throwing_unwind(void *data)
+{
+    (void)data;
+    ec_throw(ECX_EINVAL, cause_cleanup, NULL) NULL;
+}
+
+START_TEST(cause_unwind)
+{
+    struct ec_cause cause;
+    int caught = 0;
+    const char *e = NULL;
+
+    cause_cleanups = 0;
+    ec_try {
+        ec_with(e, throwing_unwind) {
+            thrower_line = __LINE__ + 1;
+            ec_throw(ECX_EIO, cause_cleanup, NULL) NULL;
+        }
+    }
+    ec_catch_a(ECX_EINVAL, e) {
+        fail_unless(ec_get_causes_len() == 1, NULL);
+        fail_unless(ec_get_causes_dropped() == 0, NULL);
+        fail_unless(ec_get_cause(0, &cause) == 1, NULL);
+        fail_unless(cause.type == ECX_EIO, NULL);
+        fail_unless(cause.line == thrower_line, NULL);
+        fail_unless(strcmp(cause.function, "cause_unwind") == 0, NULL);
+        fail_unless(ec_get_cause(1, &cause) == 0, NULL);
+        fail_unless(cause_cleanups == 0, NULL);
+        caught = 1;
+    }
+    ec_catch { }
+
+    fail_unless(caught == 1, NULL);
+    fail_unless(cause_cleanups == 2, NULL);
+    fail_unless(ec_get_causes_len() == 0, NULL);
+}
+END_TEST
+
+START_TEST(cause_catch)
+{
+    struct ec_cause cause;
+    const char *e = NULL;
+    int caught = 0;
+
+    ec_try {
+        ec_try {
+            ec_throw_str_static(ECX_EIO, "Inner.");
+        }
+        ec_catch {
+            ec_throw_str_static(ECX_EINVAL, "Outer.");
+        }
+    }
+    ec_catch_a(ECX_EINVAL, e) {
+        fail_unless(strcmp(e, "Outer.") == 0, NULL);
+        fail_unless(ec_get_cause(0, &cause) == 1, NULL);
+        fail_unless(cause.type == ECX_EIO, NULL);
+        fail_unless(strcmp(cause.data, "Inner.") == 0, NULL);
+        caught = 1;
+    }
+    ec_catch { }
+    fail_unless(caught == 1, NULL);
+}
+END_TEST
+
+/* Each level replaces the exception thrown by the levels below it. */
+static void
+cause_levels(int n)
+{
+    char *e = NULL;
+
+    if (n == 0) {
+        ec_throw(ECX_EIO, cause_cleanup, NULL) NULL;
+    }
+
+    ec_with(e, throwing_unwind) {
+        cause_levels(n - 1);
+    }
+}
+
+START_TEST(cause_dropped)
+{
+    struct ec_cause cause;
+
+    cause_cleanups = 0;
+    ec_try {
+        cause_levels(EC_CAUSES_MAX + 2);
+    }
+    ec_catch {
+        fail_unless(ec_get_causes_len() == EC_CAUSES_MAX, NULL);
+        fail_unless(ec_get_causes_dropped() == 2, NULL);
+
+        /* The first kept is the root cause. */
+        fail_unless(ec_get_cause(0, &cause) == 1, NULL);
+        fail_unless(cause.type == ECX_EIO, NULL);
+
+        /* Dropped ones are cleaned up right away. */
+        fail_unless(cause_cleanups == 2, NULL);
+
+        char buf[4096];
+        FILE *stream = fmemopen(buf, sizeof(buf), "w");
+        fail_unless(stream != NULL, NULL);
+        ec_fprint(stream);
+        fflush(stream);
+        buf[ftell(stream)] = '\0';
+        fclose(stream);
+
+        /* The current exception, each kept cause, and the dropped count. */
+        size_t lines = 0;
+        for (char *p = buf; *p != '\0'; p++) lines += *p == '\n';
+        fail_unless(lines == 1 + EC_CAUSES_MAX + 1, NULL);
+        fail_unless(strstr(buf, "  Replaced: 2 more\n") != NULL, NULL);
+        fail_unless(strstr(buf, "  Replaced: ") != NULL, NULL);
+    }
+    fail_unless(cause_cleanups == EC_CAUSES_MAX + 3, NULL);
+}
+END_TEST
+
+START_TEST(cause_capture)
+{
+    struct ec_exception *exception = NULL;
+    struct ec_cause cause;
+
+    ec_try {
+        ec_try {
+            ec_throw_str_static(ECX_EIO, "Inner.");
+        }
+        ec_catch {
+            ec_throw_str_static(ECX_EINVAL, "Outer.");
+        }
+    }
+    ec_catch {
+        exception = ec_exception_capture();
+    }
+    fail_unless(ec_get_causes_len() == 0, NULL);
+
+    ec_try {
+        ec_exception_rethrow(exception);
+    }
+    ec_catch {
+        fail_unless(ec_type(NULL) == ECX_EINVAL, NULL);
+        fail_unless(ec_get_cause(0, &cause) == 1, NULL);
+        fail_unless(cause.type == ECX_EIO, NULL);
+    }
+}
+END_TEST
+
+Suite *
+exception_suite(void)
+{
+    Suite *s = suite_create("Exception");
+
+    TCase *tc_exception = tcase_create("exception objects");
+    tcase_add_test(tc_exception, exception_none);
+    tcase_add_test(tc_exception, exception_rethrow);
+    tcase_add_test(tc_exception, exception_free);
+    tcase_add_test(tc_exception, exception_thread);
+    suite_add_tcase(s, tc_exception);
+
+    TCase *tc_cause = tcase_create("causes");
+    tcase_add_test(tc_cause, cause_unwind);
+    tcase_add_test(tc_cause, cause_catch);
+    tcase_add_test(tc_cause, cause_dropped);
+    tcase_add_test(tc_cause, cause_capture);
+    suite_add_tcase(s, tc_cause);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(exception_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
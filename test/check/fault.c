@@ -0,0 +1,419 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <ec/ec.h>
+
+static int cleanups = 0;
+
+static void
+cleanup(void *data)
+{
+    (void)data;
+    cleanups++;
+}
+
+/* Hidden from the compiler, which may turn a known NULL store into a trap. */
+static int *volatile null = NULL;
+
+static void
+segv(void)
+{
+    *null = 1;
+}
+
+static void
+segv_at(uintptr_t addr)
+{
+    int *volatile p = (int *)addr;
+    *p = 1;
+}
+
+/* Enough faults to go around the per-thread storage of faults. */
+static void
+segv_many()
+{
+    for (uintptr_t i = 0; i < 2 * (EC_CAUSES_MAX + 1); i++) {
+        ec_try {
+            segv_at(0x1000 + i * sizeof(int));
+        }
+        ec_catch { }
+    }
+}
+
+/* Rethrows exception and checks that it is the fault at addr. */
+static void
+rethrow_fault(struct ec_exception *exception, uintptr_t addr)
+{
+    const struct ec_fault *fault = NULL;
+    volatile int caught = 0;
+
+    ec_try {
+        ec_exception_rethrow(exception);
+    }
+    ec_catch_a(ECX_SEGV, fault) {
+        fail_unless(fault->signo == SIGSEGV, NULL);
+        fail_unless(fault->addr == (void *)addr, NULL);
+        caught++;
+    }
+    ec_catch {
+        fail("Wrong exception type.");
+    }
+
+    fail_unless(caught == 1, NULL);
+}
+
+START_TEST(fault_segv)
+{
+    const struct ec_fault *fault = NULL;
+    void *with = NULL;
+    volatile int caught = 0;
+
+    ec_fault_install();
+
+    /* Twice, the second fault must find the signal unblocked. */
+    for (int i = 0; i < 2; i++) {
+        ec_try {
+            ec_with(with, cleanup) {
+                segv();
+            }
+        }
+        ec_catch_a(ECX_SEGV, fault) {
+            fail_unless(fault->signo == SIGSEGV, NULL);
+            fail_unless(fault->code == SEGV_MAPERR, NULL);
+            fail_unless(fault->addr == NULL, NULL);
+            caught++;
+        }
+        ec_catch {
+            fail("Wrong exception type.");
+        }
+    }
+
+    fail_unless(caught == 2, NULL);
+    fail_unless(cleanups == 2, NULL);
+
+    ec_fault_uninstall();
+}
+END_TEST
+
+START_TEST(fault_nosig)
+{
+    const struct ec_fault *fault = NULL;
+    volatile int caught = 0;
+
+    ec_fault_install();
+
+    for (int i = 0; i < 2; i++) {
+        ec_try_nosig {
+            segv();
+        }
+        ec_catch_a(ECX_SEGV, fault) {
+            fail_unless(fault->signo == SIGSEGV, NULL);
+            caught++;
+        }
+        ec_catch { }
+    }
+
+    fail_unless(caught == 2, NULL);
+
+    /* The mask was left as it was. */
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    fail_if(sigismember(&mask, SIGSEGV), NULL);
+}
+END_TEST
+
+START_TEST(fault_capture)
+{
+    struct ec_exception *volatile exception = NULL;
+
+    ec_fault_install();
+
+    ec_try {
+        segv_at(0x10);
+    }
+    ec_catch {
+        exception = ec_exception_capture();
+    }
+    fail_unless(exception != NULL, NULL);
+
+    /* The captured fault isn't overwritten by later ones. */
+    segv_many();
+
+    rethrow_fault(exception, 0x10);
+}
+END_TEST
+
+static void *
+capture_main(void *arg)
+{
+    struct ec_exception **exception = arg;
+
+    ec_fault_thread_init();
+
+    ec_try {
+        segv_at(0x20);
+    }
+    ec_catch {
+        *exception = ec_exception_capture();
+    }
+
+    return NULL;
+}
+
+static void *
+segv_many_main(void *arg)
+{
+    (void)arg;
+
+    ec_fault_thread_init();
+    segv_many();
+
+    return NULL;
+}
+
+START_TEST(fault_capture_thread)
+{
+    struct ec_exception *exception = NULL;
+    pthread_t thread;
+
+    ec_fault_install();
+
+    fail_unless(pthread_create(&thread, NULL, capture_main, &exception) == 0, NULL);
+    pthread_join(thread, NULL);
+    fail_unless(exception != NULL, NULL);
+
+    /* The fault outlives its thread (whose storage the next one may get). */
+    fail_unless(pthread_create(&thread, NULL, segv_many_main, NULL) == 0, NULL);
+    pthread_join(thread, NULL);
+
+    rethrow_fault(exception, 0x20);
+}
+END_TEST
+
+START_TEST(fault_bus)
+{
+    const struct ec_fault *fault = NULL;
+    volatile int caught = 0;
+
+    /* Reading a mapping past the end of its file. */
+    FILE *file = tmpfile();
+    fail_unless(file != NULL, NULL);
+
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char *map = mmap(NULL, page, PROT_READ, MAP_SHARED, fileno(file), 0);
+    fail_unless(map != MAP_FAILED, NULL);
+
+    ec_fault_install();
+
+    ec_try {
+        (void)map[0];
+    }
+    ec_catch_a(ECX_BUS, fault) {
+        fail_unless(fault->signo == SIGBUS, NULL);
+        fail_unless(fault->addr == (void *)map, NULL);
+        caught++;
+    }
+    ec_catch { }
+
+    fail_unless(caught == 1, NULL);
+
+    munmap((void *)map, page);
+    fclose(file);
+}
+END_TEST
+
+#if defined(__x86_64__) || defined(__i386__)
+START_TEST(fault_fpe)
+{
+    volatile int zero = 0;
+    volatile int result = 0;
+    const struct ec_fault *fault = NULL;
+    int caught = 0;
+    int divided = 0;
+
+    ec_fault_install();
+
+    ec_try {
+        result = 1 / zero;
+        divided = 1;
+    }
+    ec_catch_a(ECX_FPE, fault) {
+        fail_unless(fault->code == FPE_INTDIV, NULL);
+        caught++;
+    }
+    ec_catch { }
+
+    /* Some emulated CPUs don't trap. */
+    fail_unless(caught == 1 || divided, NULL);
+    (void)result;
+}
+END_TEST
+#endif
+
+static __attribute__((noinline)) int
+recurse(int depth)
+{
+    volatile char frame[256];
+    frame[0] = (char)depth;
+    return recurse(depth + 1) + frame[0];
+}
+
+static void *
+overflow_main(void *arg)
+{
+    int *caught = arg;
+    const struct ec_fault *fault = NULL;
+
+    ec_fault_thread_init();
+
+    ec_try {
+        recurse(0);
+    }
+    ec_catch_a(ECX_STACK_OVERFLOW, fault) {
+        fail_unless(fault->signo == SIGSEGV, NULL);
+        (*caught)++;
+    }
+    ec_catch { }
+
+    return NULL;
+}
+
+START_TEST(fault_stack_overflow)
+{
+    int caught = 0;
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    ec_fault_install();
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    fail_unless(pthread_create(&thread, &attr, overflow_main, &caught) == 0, NULL);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    fail_unless(caught == 1, NULL);
+}
+END_TEST
+
+/* The length of the profile ec_profile_dump(...) prints. */
+static long
+profile_dumped()
+{
+    static char buf[1 << 16];
+
+    FILE *stream = fmemopen(buf, sizeof(buf), "w");
+    fail_unless(stream != NULL, NULL);
+    ec_profile_dump(stream);
+    fflush(stream);
+    long len = ftell(stream);
+    fclose(stream);
+
+    return len;
+}
+
+START_TEST(fault_profile)
+{
+    /* The profiler locks and allocates, so faults aren't sampled. */
+    ec_fault_install();
+    ec_profile_reset();
+    ec_profile_start(1);
+
+    ec_try {
+        segv();
+    }
+    ec_catch { }
+    fail_unless(profile_dumped() == 0, NULL);
+
+    ec_try {
+        ec_throw_str_static(ECX_EC, "Sampled.");
+    }
+    ec_catch { }
+    fail_unless(profile_dumped() > 0, NULL);
+
+    ec_profile_stop();
+    ec_profile_reset();
+}
+END_TEST
+
+START_TEST(fault_uncaught)
+{
+    /* Without an ec_try the fault is fatal as usual. */
+    pid_t pid = fork();
+    fail_unless(pid >= 0, NULL);
+
+    if (pid == 0) {
+        ec_fault_install();
+        segv();
+        _exit(0);
+    }
+
+    int status = 0;
+    fail_unless(waitpid(pid, &status, 0) == pid, NULL);
+    fail_unless(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV, NULL);
+}
+END_TEST
+
+Suite *
+fault_suite(void)
+{
+    Suite *s = suite_create("Fault");
+
+    TCase *tc_fault = tcase_create("fault");
+    tcase_add_test(tc_fault, fault_segv);
+    tcase_add_test(tc_fault, fault_nosig);
+    tcase_add_test(tc_fault, fault_capture);
+    tcase_add_test(tc_fault, fault_capture_thread);
+    tcase_add_test(tc_fault, fault_bus);
+#if defined(__x86_64__) || defined(__i386__)
+    tcase_add_test(tc_fault, fault_fpe);
+#endif
+    tcase_add_test(tc_fault, fault_stack_overflow);
+    tcase_add_test(tc_fault, fault_profile);
+    tcase_add_test(tc_fault, fault_uncaught);
+    suite_add_tcase(s, tc_fault);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    ec_core_policy(EC_CORE_OFF, 0);
+
+    SRunner *sr = srunner_create(fault_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
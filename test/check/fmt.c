@@ -0,0 +1,152 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+#include <ec/static/ec.h>
+
+START_TEST(fmt_throw_catch)
+{
+    const struct ec_fmt *f = NULL;
+
+    ec_try {
+        char name[] = "records.db";
+        ec_throw_fmt(ECX_EINVAL, "Bad record %zu in '%s' (%d%%).", (size_t)42, name, -7);
+    }
+    ec_catch_a(ECX_EINVAL, f) {
+        fail_unless(strcmp(ec_fmt_str(f), "Bad record 42 in 'records.db' (-7%).") == 0, NULL);
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+}
+END_TEST
+
+START_TEST(fmt_conversions)
+{
+    struct ec_fmt *f = ec_fmt_capture(
+            "%5d|%-4u|%x|%ld|%lld|%jd|%c|%.2f|%Lg|%s|%.3s|%*d|%.*f|%hhd",
+            42, 7u, 255u, -1L, 1LL << 40, (intmax_t)-9, 'z', 3.14159,
+            (long double)2.5, "str", "truncate", 4, 9, 1, 2.25, 300);
+    fail_unless(f != NULL, NULL);
+    fail_unless(strcmp(ec_fmt_str(f),
+            "   42|7   |ff|-1|1099511627776|-9|z|3.14|2.5|str|tru|   9|2.2|44") == 0, NULL);
+    ec_fmt_release(f);
+
+    f = ec_fmt_capture("%p", (void *)NULL);
+    char expect[32];
+    snprintf(expect, sizeof(expect), "%p", (void *)NULL);
+    fail_unless(strcmp(ec_fmt_str(f), expect) == 0, NULL);
+    ec_fmt_release(f);
+}
+END_TEST
+
+START_TEST(fmt_overflow)
+{
+    char big[EC_FMT_ARGS_MAX * 2];
+    memset(big, 'a', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    /* The string is cut short and the rest of the format dropped. */
+    struct ec_fmt *f = ec_fmt_capture("[%s] %d", big, 7);
+    const char *text = ec_fmt_str(f);
+    fail_unless(strncmp(text, "[aaaa", 5) == 0, NULL);
+    fail_unless(strcmp(text + strlen(text) - 3, "...") == 0, NULL);
+    fail_unless(strchr(text, ']') == NULL, NULL);
+    ec_fmt_release(f);
+
+    /* Unsupported conversions stop the capture as well. */
+    f = ec_fmt_capture("ok %d %ls %d", 1, L"wide", 2);
+    fail_unless(strcmp(ec_fmt_str(f), "ok 1 ...") == 0, NULL);
+    ec_fmt_release(f);
+}
+END_TEST
+
+START_TEST(fmt_fprint)
+{
+    char *out = NULL;
+    size_t out_len = 0;
+    FILE *stream = open_memstream(&out, &out_len);
+    fail_unless(stream != NULL, NULL);
+
+    struct ec_fmt *f = ec_fmt_capture("%s=%d", "answer", 42);
+    ec_fprint_fmt(stream, f);
+    ec_fmt_release(f);
+    fclose(stream);
+
+    fail_unless(strcmp(out, "answer=42") == 0, NULL);
+    free(out);
+}
+END_TEST
+
+START_TEST(fmt_slots)
+{
+    struct ec_fmt *f[4];
+
+    /* More captures than per-thread slots are allocated instead. */
+    for (int i = 0; i < 4; i++) {
+        f[i] = ec_fmt_capture("%d", i);
+        fail_unless(f[i] != NULL, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        char expect[2] = { '0' + i, '\0' };
+        fail_unless(strcmp(ec_fmt_str(f[i]), expect) == 0, NULL);
+        ec_fmt_release(f[i]);
+    }
+
+    /* Released slots are reused. */
+    struct ec_fmt *g = ec_fmt_capture("again");
+    fail_unless(g == f[0] || g == f[1], NULL);
+    ec_fmt_release(g);
+}
+END_TEST
+
+Suite *
+fmt_suite(void)
+{
+    Suite *s = suite_create("Format");
+
+    TCase *tc_fmt = tcase_create("Deferred Formatting");
+    tcase_add_test(tc_fmt, fmt_throw_catch);
+    tcase_add_test(tc_fmt, fmt_conversions);
+    tcase_add_test(tc_fmt, fmt_overflow);
+    tcase_add_test(tc_fmt, fmt_fprint);
+    tcase_add_test(tc_fmt, fmt_slots);
+    suite_add_tcase(s, tc_fmt);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(fmt_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,235 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <ec/ec.h>
+
+#define THREADS 8
+#define RECORDS 5000
+
+/* Returns a descriptor for a new (unlinked) temporary file. */
+static int
+log_file()
+{
+    char path[] = "/tmp/ec-log-XXXXXX";
+    int fd = mkstemp(path);
+    fail_unless(fd >= 0, NULL);
+    unlink(path);
+    return fd;
+}
+
+/* Returns the contents of the file fd (to be freed). */
+static char *
+log_read(int fd, size_t *len)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    fail_unless(size >= 0, NULL);
+
+    char *contents = malloc(size + 1);
+    fail_unless(contents != NULL, NULL);
+    fail_unless(pread(fd, contents, size, 0) == size, NULL);
+    contents[size] = '\0';
+
+    *len = size;
+    return contents;
+}
+
+static void *
+log_records(void *arg)
+{
+    unsigned long thread = (unsigned long)arg;
+
+    for (unsigned long i = 0; i < RECORDS; i++) {
+        char record[64];
+        int len = snprintf(record, sizeof(record), "thread %lu record %lu\n", thread, i);
+        ec_log_write(record, len);
+    }
+
+    return NULL;
+}
+
+START_TEST(log_threads)
+{
+    int fd = log_file();
+    pthread_t threads[THREADS];
+
+    ec_log_start(fd);
+
+    for (unsigned long i = 0; i < THREADS; i++) {
+        fail_unless(pthread_create(&threads[i], NULL, log_records, (void *)i) == 0, NULL);
+    }
+
+    for (unsigned long i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ec_log_flush();
+
+    /* Every record is whole and each thread's are in order. */
+    size_t len = 0;
+    char *contents = log_read(fd, &len);
+    unsigned long next[THREADS] = {0};
+    unsigned long lines = 0;
+
+    for (char *line = strtok(contents, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        unsigned long thread = 0, record = 0;
+        fail_unless(sscanf(line, "thread %lu record %lu", &thread, &record) == 2, NULL);
+        fail_unless(thread < THREADS, NULL);
+        fail_unless(record == next[thread], NULL);
+        next[thread]++;
+        lines++;
+    }
+
+    fail_unless(lines == THREADS * RECORDS, NULL);
+    free(contents);
+
+    ec_log_stop();
+
+    close(fd);
+}
+END_TEST
+
+START_TEST(log_fprint)
+{
+    int fd = log_file();
+
+    FILE *expected = tmpfile();
+    fail_unless(expected != NULL, NULL);
+
+    ec_log_start(fd);
+
+    ec_try {
+        ec_throw_str_static(ECX_EIO, "Logged.");
+    }
+    ec_catch {
+        ec_fprint(expected);
+        ec_log_fprint();
+    }
+
+    ec_log_stop();
+    fflush(expected);
+
+    size_t len = 0;
+    char *contents = log_read(fd, &len);
+    size_t expected_len = 0;
+    char *expected_contents = log_read(fileno(expected), &expected_len);
+
+    fail_unless(len == expected_len, NULL);
+    fail_unless(strcmp(contents, expected_contents) == 0, NULL);
+    fail_unless(strstr(contents, "Logged.") != NULL, NULL);
+
+    free(contents);
+    free(expected_contents);
+    fclose(expected);
+    close(fd);
+}
+END_TEST
+
+START_TEST(log_truncate)
+{
+    int fd = log_file();
+    char *data = malloc(EC_LOG_RECORD_MAX * 2);
+    fail_unless(data != NULL, NULL);
+    memset(data, 'x', EC_LOG_RECORD_MAX * 2 - 1);
+    data[EC_LOG_RECORD_MAX * 2 - 1] = '\0';
+
+    ec_log_start(fd);
+
+    ec_try {
+        ec_throw_str(ECX_EIO) data;
+    }
+    ec_catch {
+        ec_log_fprint();
+    }
+
+    ec_log_stop();
+
+    size_t len = 0;
+    char *contents = log_read(fd, &len);
+    fail_unless(len == EC_LOG_RECORD_MAX, NULL);
+    fail_unless(strcmp(contents + len - 4, "...\n") == 0, NULL);
+
+    free(contents);
+    close(fd);
+}
+END_TEST
+
+START_TEST(log_uncaught)
+{
+    int fd = log_file();
+
+    pid_t pid = fork();
+    fail_unless(pid >= 0, NULL);
+
+    if (pid == 0) {
+        ec_log_start(fd);
+        ec_throw_str_static(ECX_EIO, "Nobody catches this.");
+    }
+
+    int status = 0;
+    fail_unless(waitpid(pid, &status, 0) == pid, NULL);
+    fail_unless(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, NULL);
+
+    /* Flushed before the abort. */
+    size_t len = 0;
+    char *contents = log_read(fd, &len);
+    fail_unless(strstr(contents, "Nobody catches this.") != NULL, NULL);
+    fail_unless(strstr(contents, "Error stack empty: Abort!\n") != NULL, NULL);
+
+    free(contents);
+    close(fd);
+}
+END_TEST
+
+Suite *
+log_suite(void)
+{
+    Suite *s = suite_create("Log");
+
+    TCase *tc_log = tcase_create("log");
+    tcase_add_test(tc_log, log_threads);
+    tcase_add_test(tc_log, log_fprint);
+    tcase_add_test(tc_log, log_truncate);
+    tcase_add_test(tc_log, log_uncaught);
+    suite_add_tcase(s, tc_log);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(log_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+const char APP_ERROR[] = "Application error.";
+
+__attribute__((noinline)) void
+profile_thrower()
+{
+    ec_throw_str_static(APP_ERROR, "Oops.");
+}
+
+/* Dump the profile into buf and return the total of the sample counts. */
+static unsigned long
+dump(char *buf, size_t size)
+{
+    FILE *stream = fmemopen(buf, size, "w");
+    fail_unless(stream != NULL, NULL);
+    ec_profile_dump(stream);
+    fflush(stream);
+    buf[ftell(stream)] = '\0';
+    fclose(stream);
+
+    unsigned long total = 0;
+    for (char *line = buf; *line != '\0';) {
+        char *end = strchr(line, '\n');
+        fail_unless(end != NULL, NULL);
+
+        char *count = end;
+        while (count > line && count[-1] != ' ') count--;
+        total += strtoul(count, NULL, 10);
+
+        line = end + 1;
+    }
+
+    return total;
+}
+
+START_TEST(profile_folded)
+{
+    static char buf[1 << 16];
+
+    ec_profile_start(1);
+    for (int i = 0; i < 10; i++) {
+        ec_try {
+            profile_thrower();
+        }
+        ec_catch { }
+    }
+    ec_profile_stop();
+
+    /* Not sampled. */
+    ec_try {
+        profile_thrower();
+    }
+    ec_catch { }
+
+    fail_unless(dump(buf, sizeof(buf)) == 10, NULL);
+    fail_unless(strstr(buf, ";Exception(Application error.) ") != NULL, NULL);
+    fail_unless(strstr(buf, "profile.c:") != NULL, NULL);
+#if defined(HAVE_UNWIND_H) && defined(HAVE_DLFCN_H)
+    fail_unless(strstr(buf, ";profile_thrower;Exception(") != NULL, NULL);
+#endif
+
+    ec_profile_reset();
+    fail_unless(dump(buf, sizeof(buf)) == 0, NULL);
+}
+END_TEST
+
+START_TEST(profile_sampled)
+{
+    static char buf[1 << 16];
+
+    ec_profile_start(4);
+    for (int i = 0; i < 100; i++) {
+        ec_try {
+            profile_thrower();
+        }
+        ec_catch { }
+    }
+    ec_profile_stop();
+
+    fail_unless(dump(buf, sizeof(buf)) == 25, NULL);
+}
+END_TEST
+
+Suite *
+profile_suite(void)
+{
+    Suite *s = suite_create("Profile");
+
+    TCase *tc_profile = tcase_create("Profile");
+    tcase_add_test(tc_profile, profile_folded);
+    tcase_add_test(tc_profile, profile_sampled);
+    suite_add_tcase(s, tc_profile);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(profile_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,242 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <ec/ec.h>
+
+static char dir[] = "/tmp/ec-recorder-XXXXXX";
+
+/* A recorder file read back. */
+struct recording {
+    struct ec_recorder_header header;
+    struct ec_record records[EC_RECORDER_RECORDS];
+};
+
+/* Reads the file of the thread tid of process pid (NULL if there is none). */
+static struct recording *
+recording_read(pid_t pid, pid_t tid)
+{
+    char path[sizeof(dir) + 64];
+    snprintf(path, sizeof(path), "%s/ec-%ld-%ld.rec", dir, (long)pid, (long)tid);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    struct recording *recording = malloc(sizeof(*recording));
+    fail_unless(recording != NULL, NULL);
+    fail_unless(fread(recording, sizeof(*recording), 1, file) == 1, NULL);
+    fclose(file);
+
+    struct ec_recorder_header *header = &recording->header;
+    fail_unless(memcmp(header->magic, EC_RECORDER_MAGIC, sizeof(header->magic)) == 0, NULL);
+    fail_unless(header->record_size == sizeof(struct ec_record), NULL);
+    fail_unless(header->records == EC_RECORDER_RECORDS, NULL);
+    fail_unless(header->pid == (uint32_t)pid, NULL);
+    fail_unless(header->tid == (uint32_t)tid, NULL);
+
+    return recording;
+}
+
+static pid_t
+gettid_()
+{
+    return (pid_t)syscall(SYS_gettid);
+}
+
+static void
+setup(void)
+{
+    fail_unless(mkdtemp(dir) != NULL, NULL);
+}
+
+static void
+teardown(void)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) return;
+
+    for (struct dirent *entry; (entry = readdir(d)) != NULL;) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[sizeof(dir) + 256];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+
+    closedir(d);
+    rmdir(dir);
+}
+
+START_TEST(recorder_records)
+{
+    volatile unsigned int line = 0;
+
+    ec_recorder_start(dir);
+
+    ec_try {
+        line = __LINE__ + 1;
+        ec_throw_str_static(ECX_EIO, "Short read.");
+    }
+    ec_catch { }
+
+    ec_try {
+        ec_throw_fmt(ECX_EINVAL, "Bad record %d.", 7);
+    }
+    ec_catch { }
+
+    ec_try {
+        ec_throw_errno(ENOENT, NULL) NULL;
+    }
+    ec_catch { }
+
+    ec_recorder_stop();
+
+    /* Not recorded. */
+    ec_try {
+        ec_throw_str_static(ECX_EIO, "Stopped.");
+    }
+    ec_catch { }
+
+    struct recording *recording = recording_read(getpid(), gettid_());
+    fail_unless(recording != NULL, NULL);
+    fail_unless(recording->header.next == 3, NULL);
+
+    struct ec_record *record = &recording->records[0];
+    fail_unless(record->seq == 1, NULL);
+    fail_unless(record->time != 0, NULL);
+    fail_unless(record->tid == (uint32_t)gettid_(), NULL);
+    fail_unless(record->errnum == EIO, NULL);
+    fail_unless(record->line == line, NULL);
+    fail_unless(strcmp(record->type, ECX_EIO) == 0, NULL);
+    fail_unless(strcmp(record->function, "recorder_records") == 0, NULL);
+    fail_unless(strstr(record->file, "recorder.c") != NULL, NULL);
+    fail_unless(strcmp(record->data, "Short read.") == 0, NULL);
+
+    record = &recording->records[1];
+    fail_unless(record->seq == 2, NULL);
+    fail_unless(record->errnum == EINVAL, NULL);
+    fail_unless(strcmp(record->data, "Bad record %d.") == 0, NULL);
+
+    record = &recording->records[2];
+    fail_unless(record->seq == 3, NULL);
+    fail_unless(record->errnum == ENOENT, NULL);
+    fail_unless(record->data[0] == '\0', NULL);
+
+    free(recording);
+}
+END_TEST
+
+START_TEST(recorder_wrap)
+{
+    const unsigned int throws = EC_RECORDER_RECORDS + 10;
+
+    ec_recorder_start(dir);
+
+    for (unsigned int i = 0; i < throws; i++) {
+        ec_try {
+            ec_throw_str_static(ECX_EIO, "Again.");
+        }
+        ec_catch { }
+    }
+
+    ec_recorder_stop();
+
+    struct recording *recording = recording_read(getpid(), gettid_());
+    fail_unless(recording != NULL, NULL);
+    fail_unless(recording->header.next == throws, NULL);
+
+    /* The oldest were overwritten. */
+    fail_unless(recording->records[0].seq == EC_RECORDER_RECORDS + 1, NULL);
+    fail_unless(recording->records[10].seq == 11, NULL);
+
+    free(recording);
+}
+END_TEST
+
+START_TEST(recorder_crash)
+{
+    pid_t pid = fork();
+    fail_unless(pid >= 0, NULL);
+
+    if (pid == 0) {
+        ec_recorder_start(dir);
+
+        ec_try {
+            ec_throw_str_static(ECX_EIO, "Caught.");
+        }
+        ec_catch { }
+
+        ec_throw_str_static(ECX_EFAULT, "Not caught.");
+    }
+
+    int status = 0;
+    fail_unless(waitpid(pid, &status, 0) == pid, NULL);
+    fail_unless(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, NULL);
+
+    /* The child was single threaded. */
+    struct recording *recording = recording_read(pid, pid);
+    fail_unless(recording != NULL, NULL);
+    fail_unless(recording->header.next == 2, NULL);
+    fail_unless(strcmp(recording->records[1].type, ECX_EFAULT) == 0, NULL);
+    fail_unless(strcmp(recording->records[1].data, "Not caught.") == 0, NULL);
+
+    free(recording);
+}
+END_TEST
+
+Suite *
+recorder_suite(void)
+{
+    Suite *s = suite_create("Recorder");
+
+    TCase *tc_recorder = tcase_create("recorder");
+    tcase_add_test(tc_recorder, recorder_records);
+    tcase_add_test(tc_recorder, recorder_wrap);
+    tcase_add_test(tc_recorder, recorder_crash);
+    suite_add_tcase(s, tc_recorder);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    ec_core_policy(EC_CORE_OFF, 0);
+    setup();
+
+    SRunner *sr = srunner_create(recorder_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+    teardown();
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,173 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+#define THREADS 4
+#define THROWS 100
+
+const char APP_ERROR[] = "Application error.";
+
+static unsigned long long
+type_throws(const struct ec_stats *stats, const char *type)
+{
+    for (size_t i = 0; i < stats->types_len; i++) {
+        if (stats->types[i].type == type) return stats->types[i].throws;
+    }
+    return 0;
+}
+
+static void
+throw_and_catch(int rethrow)
+{
+    char *s = NULL;
+
+    ec_try {
+        ec_with(s, free) {
+            s = strdup("x");
+            ec_try {
+                ec_throw_str_static(APP_ERROR, "Oops.");
+            }
+            ec_catch {
+                if (rethrow) ec_rethrow;
+            }
+        }
+    }
+    ec_catch { }
+}
+
+START_TEST(stats_counts)
+{
+    struct ec_stats before, after;
+
+    ec_stats_snapshot(&before);
+    throw_and_catch(0);
+    throw_and_catch(1);
+    ec_stats_snapshot(&after);
+
+    fail_unless(after.throws - before.throws == 2, NULL);
+    fail_unless(after.rethrows - before.rethrows == 1, NULL);
+    fail_unless(after.catches - before.catches == 2, NULL);
+    fail_unless(after.tries - before.tries == 4, NULL);
+    fail_unless(after.windings - before.windings == 2, NULL);
+    fail_unless(after.unwinds - before.unwinds == 2, NULL);
+    fail_unless(type_throws(&after, APP_ERROR) - type_throws(&before, APP_ERROR) == 2, NULL);
+}
+END_TEST
+
+static pthread_barrier_t barrier;
+
+static void *
+thread_main(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < THROWS; i++) {
+        ec_try {
+            ec_throw_errno(ENOENT, NULL) NULL;
+        }
+        ec_catch { }
+    }
+
+    /* Stay alive until the live snapshot has been taken. */
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+
+    return NULL;
+}
+
+START_TEST(stats_threads)
+{
+    struct ec_stats stats;
+    pthread_t pth[THREADS];
+
+    pthread_barrier_init(&barrier, NULL, THREADS + 1);
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&pth[i], NULL, thread_main, NULL);
+    }
+
+    /* Live threads. */
+    pthread_barrier_wait(&barrier);
+    ec_stats_snapshot(&stats);
+    fail_unless(type_throws(&stats, ECX_ENOENT) == THREADS * THROWS, NULL);
+    fail_unless(stats.types[0].type == ECX_ENOENT, NULL);
+
+    /* Exited threads. */
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(pth[i], NULL);
+    }
+    ec_stats_snapshot(&stats);
+    fail_unless(type_throws(&stats, ECX_ENOENT) == THREADS * THROWS, NULL);
+    fail_unless(stats.catches >= THREADS * THROWS, NULL);
+
+    pthread_barrier_destroy(&barrier);
+}
+END_TEST
+
+START_TEST(stats_types_overflow)
+{
+    static const char types[EC_STATS_TYPES + 4][2];
+    struct ec_stats stats;
+
+    for (int i = 0; i < EC_STATS_TYPES + 4; i++) {
+        ec_try {
+            ec_throw_str_static(types[i], "Oops.");
+        }
+        ec_catch { }
+    }
+
+    ec_stats_snapshot(&stats);
+    fail_unless(stats.types_len == EC_STATS_TYPES, NULL);
+    fail_unless(stats.throws_other == 4, NULL);
+}
+END_TEST
+
+Suite *
+stats_suite(void)
+{
+    Suite *s = suite_create("Stats");
+
+    TCase *tc_stats = tcase_create("Statistics");
+    tcase_add_test(tc_stats, stats_counts);
+    tcase_add_test(tc_stats, stats_threads);
+    tcase_add_test(tc_stats, stats_types_overflow);
+    suite_add_tcase(s, tc_stats);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(stats_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
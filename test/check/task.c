@@ -0,0 +1,189 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ec/ec.h>
+
+#define TASKS 1000
+
+static struct ec_task_group *group = NULL;
+static unsigned long counter = 0;
+
+static void
+count(void *arg)
+{
+    (void)arg;
+    __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+}
+
+/* Counts the nodes of a binary tree of the given depth, spawning a task per
+ * node.
+ */
+static void
+tree(void *arg)
+{
+    size_t depth = (size_t)arg;
+
+    count(NULL);
+    if (depth > 0) {
+        ec_task_group_spawn(group, tree, (void *)(depth - 1));
+        ec_task_group_spawn(group, tree, (void *)(depth - 1));
+    }
+}
+
+static unsigned int thrower_line = 0;
+
+static void
+thrower(void *arg)
+{
+    (void)arg;
+    thrower_line = __LINE__ + 1;
+    ec_throw_str_static(ECX_EIO, "Task failed.");
+}
+
+static int released = 0;
+
+static void
+blocker(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE)) { }
+}
+
+START_TEST(task_count)
+{
+    group = ec_task_group_new(4);
+
+    counter = 0;
+    for (size_t i = 0; i < TASKS; i++) {
+        ec_task_group_spawn(group, count, NULL);
+    }
+    ec_task_group_wait(group);
+    fail_unless(counter == TASKS, NULL);
+
+    /* Tasks spawning tasks (2^10 - 1 nodes). */
+    counter = 0;
+    ec_task_group_spawn(group, tree, (void *)9);
+    ec_task_group_wait(group);
+    fail_unless(counter == 1023, NULL);
+
+    ec_task_group_free(group);
+}
+END_TEST
+
+START_TEST(task_exception)
+{
+    const char *e = NULL;
+    int caught = 0;
+
+    /* One worker takes its newest task first: The thrower cancels the
+     * others (the blocker is either running, or cancelled too).
+     */
+    group = ec_task_group_new(1);
+
+    counter = 0;
+    released = 0;
+    ec_task_group_spawn(group, blocker, NULL);
+    for (size_t i = 0; i < 100; i++) {
+        ec_task_group_spawn(group, count, NULL);
+    }
+    ec_task_group_spawn(group, thrower, NULL);
+    __atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+
+    ec_try {
+        ec_task_group_wait(group);
+    }
+    ec_catch_a(ECX_EIO, e) {
+        fail_unless(strcmp(e, "Task failed.") == 0, NULL);
+        fail_unless(strcmp(ec_get_function(), "thrower") == 0, NULL);
+        fail_unless(ec_get_line() == thrower_line, NULL);
+        caught = 1;
+    }
+    ec_catch {
+        fail("Wrong exception type.");
+    }
+    fail_unless(caught == 1, NULL);
+    fail_unless(counter == 0, NULL);
+
+    /* The group is usable again. */
+    ec_task_group_spawn(group, count, NULL);
+    ec_task_group_wait(group);
+    fail_unless(counter == 1, NULL);
+
+    ec_task_group_free(group);
+}
+END_TEST
+
+START_TEST(task_exception_many)
+{
+    const char *e = NULL;
+    int caught = 0;
+
+    group = ec_task_group_new(4);
+
+    /* Only one is rethrown. */
+    for (size_t i = 0; i < TASKS; i++) {
+        ec_task_group_spawn(group, thrower, NULL);
+    }
+
+    ec_try {
+        ec_task_group_wait(group);
+    }
+    ec_catch_a(ECX_EIO, e) {
+        caught++;
+    }
+    ec_catch { }
+    fail_unless(caught == 1, NULL);
+
+    /* Freed along with an exception nobody waited for. */
+    ec_task_group_spawn(group, thrower, NULL);
+    ec_task_group_free(group);
+}
+END_TEST
+
+Suite *
+task_suite(void)
+{
+    Suite *s = suite_create("Task");
+
+    TCase *tc_task = tcase_create("task group");
+    tcase_add_test(tc_task, task_count);
+    tcase_add_test(tc_task, task_exception);
+    tcase_add_test(tc_task, task_exception_many);
+    suite_add_tcase(s, tc_task);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(task_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -17,6 +17,7 @@
  */
 
 #include <check.h>
+#include <signal.h>
 #include <stdlib.h>
 
 #include <ec/ec.h>
@@ -53,6 +54,75 @@ START_TEST(try_throw_static_catch)
 }
 END_TEST
 
+/* Thrown from inside the library, which must use the same ec_longjmp. */
+START_TEST(try_library_throw_catch)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(64);
+    const char *e = NULL;
+
+    ec_try {
+        ec_arena_alloc(&arena, SIZE_MAX);
+    }
+    ec_catch_a(ECX_ENOMEM, e) {
+        fail_unless(strcmp(e, "Arena allocation too large.") == 0, NULL);
+    }
+    ec_catch {
+        fail("Wrong exception type.");
+    }
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
+static int
+usr1_blocked()
+{
+    sigset_t set;
+    sigprocmask(SIG_BLOCK, NULL, &set);
+    return sigismember(&set, SIGUSR1);
+}
+
+static void
+block_usr1(int how)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigprocmask(how, &set, NULL);
+}
+
+#if !defined(EC_FASTJMP) && !defined(EC_TRY_NOSIG)
+START_TEST(try_sigmask_restored)
+{
+    ec_try {
+        block_usr1(SIG_BLOCK);
+        ec_throw_str_static(ECX_EC, "Catch me!");
+    }
+    ec_catch {
+        /* The mask saved by ec_try was restored. */
+        fail_unless(usr1_blocked() == 0, NULL);
+    }
+}
+END_TEST
+#endif
+
+START_TEST(try_nosig_throw_catch)
+{
+    ec_try_nosig {
+        block_usr1(SIG_BLOCK);
+        ec_throw_str_static(ECX_EC, "Catch me!");
+    }
+    ec_catch {
+        fail_unless(strcmp(ec_get_data(), "Catch me!") == 0, NULL);
+
+        /* The mask was not saved so the change survives the throw. */
+        fail_unless(usr1_blocked() == 1, NULL);
+    }
+
+    block_usr1(SIG_UNBLOCK);
+}
+END_TEST
+
 Suite *
 try_suite(void)
 {
@@ -62,8 +132,16 @@ try_suite(void)
     tcase_add_test(tc_ttc, try_catch);
     tcase_add_test(tc_ttc, try_throw_catch);
     tcase_add_test(tc_ttc, try_throw_static_catch);
+    tcase_add_test(tc_ttc, try_library_throw_catch);
     suite_add_tcase(s, tc_ttc);
 
+    TCase *tc_sig = tcase_create("signal mask");
+#if !defined(EC_FASTJMP) && !defined(EC_TRY_NOSIG)
+    tcase_add_test(tc_sig, try_sigmask_restored);
+#endif
+    tcase_add_test(tc_sig, try_nosig_throw_catch);
+    suite_add_tcase(s, tc_sig);
+
     return s;
 }
 
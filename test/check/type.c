@@ -0,0 +1,194 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+
+#include <ec/ec.h>
+#include <ec/static/ec.h>
+
+const char APP_ERROR[] = "Application error.";
+const char APP_IO[] = "Application I/O error.";
+const char APP_PARSE[] = "Application parse error.";
+
+struct ec_type_desc app_error = EC_TYPE_DESC(APP_ERROR, NULL, free, ec_fprint_str);
+struct ec_type_desc app_io = EC_TYPE_DESC(APP_IO, &app_error, free, ec_fprint_str);
+struct ec_type_desc app_disk = EC_TYPE_DESC(ECX_EIO, &app_io, free, ec_fprint_str);
+struct ec_type_desc app_parse = EC_TYPE_DESC(APP_PARSE, &app_error, NULL, ec_fprint_str);
+
+START_TEST(type_is_a)
+{
+    fail_unless(ec_type_desc_is_a(&app_disk, &app_disk) == 1, NULL);
+    fail_unless(ec_type_desc_is_a(&app_disk, &app_io) == 1, NULL);
+    fail_unless(ec_type_desc_is_a(&app_disk, &app_error) == 1, NULL);
+    fail_unless(ec_type_desc_is_a(&app_io, &app_disk) == 0, NULL);
+    fail_unless(ec_type_desc_is_a(&app_parse, &app_io) == 0, NULL);
+    fail_unless(ec_type_desc_is_a(&app_parse, &app_error) == 1, NULL);
+
+    fail_unless(app_error.depth == 1, NULL);
+    fail_unless(app_disk.depth == 3, NULL);
+}
+END_TEST
+
+START_TEST(type_catch_desc)
+{
+    const char *e = NULL;
+
+    ec_try {
+        ec_throw_desc(&app_disk) strdup("Disk on fire.");
+    }
+    ec_catch_desc(&app_parse, e) {
+        fail("Caught by an unrelated type!");
+    }
+    ec_catch_desc(&app_io, e) {
+        fail_unless(strcmp(e, "Disk on fire.") == 0, NULL);
+        fail_unless(ec_get_desc() == &app_disk, NULL);
+        fail_unless(ec_type(NULL) == ECX_EIO, NULL);
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+}
+END_TEST
+
+START_TEST(type_catch_a)
+{
+    const char *e = NULL;
+
+    /* The descriptor's type is usable as a plain type. */
+    ec_try {
+        ec_throw_desc(&app_disk) strdup("Disk on fire.");
+    }
+    ec_catch_a(ECX_EIO, e) {
+        fail_unless(strcmp(e, "Disk on fire.") == 0, NULL);
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+}
+END_TEST
+
+START_TEST(type_catch_plain)
+{
+    const char *e = NULL;
+    int caught = 0;
+
+    /* Thrown by type alone: matches the descriptor of that type... */
+    ec_try {
+        ec_throw_str(ECX_EIO) strdup("Disk on fire.");
+    }
+    ec_catch_desc(&app_disk, e) {
+        caught = 1;
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+    fail_unless(caught == 1, NULL);
+
+    /* ...but not its ancestors. */
+    caught = 0;
+    ec_try {
+        ec_throw_str(ECX_EIO) strdup("Disk on fire.");
+    }
+    ec_catch_desc(&app_io, e) {
+        fail("Caught by an ancestor!");
+    }
+    ec_catch {
+        caught = 1;
+    }
+    fail_unless(caught == 1, NULL);
+}
+END_TEST
+
+START_TEST(type_shadow)
+{
+    const char *e = NULL;
+
+    ec_try {
+        ec_shadow_on_x(ECX_EIO, APP_PARSE) {
+            ec_throw_desc(&app_disk) strdup("Disk on fire.");
+        }
+    }
+    ec_catch_desc(&app_io, e) {
+        fail("Shadowed type caught by the original descriptor!");
+    }
+    ec_catch_a(APP_PARSE, e) {
+        fail_unless(ec_get_desc() == NULL, NULL);
+    }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+}
+END_TEST
+
+START_TEST(type_deep)
+{
+    static struct ec_type_desc chain[EC_TYPE_DEPTH_MAX * 2];
+    const void *e = NULL;
+
+    for (int i = 0; i < EC_TYPE_DEPTH_MAX * 2; i++) {
+        chain[i].type = (const char *)&chain[i];
+        chain[i].parent = i == 0 ? NULL : &chain[i - 1];
+    }
+
+    struct ec_type_desc *leaf = &chain[EC_TYPE_DEPTH_MAX * 2 - 1];
+    fail_unless(ec_type_desc_is_a(leaf, &chain[0]) == 1, NULL);
+    fail_unless(ec_type_desc_is_a(leaf, &chain[EC_TYPE_DEPTH_MAX + 1]) == 1, NULL);
+    fail_unless(ec_type_desc_is_a(&chain[EC_TYPE_DEPTH_MAX + 1], leaf) == 0, NULL);
+
+    ec_try {
+        ec_throw_desc(leaf) NULL;
+    }
+    ec_catch_desc(&chain[EC_TYPE_DEPTH_MAX + 2], e) { }
+    ec_catch {
+        fail("Exception should already have been handled!");
+    }
+}
+END_TEST
+
+Suite *
+type_suite(void)
+{
+    Suite *s = suite_create("Type");
+
+    TCase *tc_type = tcase_create("Type Descriptors");
+    tcase_add_test(tc_type, type_is_a);
+    tcase_add_test(tc_type, type_catch_desc);
+    tcase_add_test(tc_type, type_catch_a);
+    tcase_add_test(tc_type, type_catch_plain);
+    tcase_add_test(tc_type, type_shadow);
+    tcase_add_test(tc_type, type_deep);
+    suite_add_tcase(s, tc_type);
+
+    return s;
+}
+
+int
+main(void)
+{
+    int failed = 0;
+
+    SRunner *sr = srunner_create(type_suite());
+
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+
+    srunner_free(sr);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
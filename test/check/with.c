@@ -17,7 +17,12 @@
  */
 
 #include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <ec/ec.h>
 #include <ec/static/ec.h>
@@ -76,6 +81,31 @@ START_TEST(with_ok_thrown)
 }
 END_TEST
 
+/* Thrown from inside the library, which must unwind the windings of the
+ * program's ec_with(...) (EC_INLINE adds them itself).
+ */
+START_TEST(with_library_thrown)
+{
+    struct ec_arena arena = EC_ARENA_INITIALIZER(64);
+
+    ec_try {
+        int *free_me = malloc(sizeof(int));
+        fail_unless(free_me != NULL, NULL);
+
+        with_free_ok_called = 0;
+        ec_with(free_me, with_free_ok) {
+            ec_arena_alloc(&arena, SIZE_MAX);
+        }
+        fail("An exception should have been thrown.");
+    }
+    ec_catch {
+        fail_unless(with_free_ok_called == 1, NULL);
+    }
+
+    ec_arena_release(&arena);
+}
+END_TEST
+
 START_TEST(with_x)
 {
     ec_try {
@@ -216,6 +246,397 @@ START_TEST(with_nested_3_alt)
 }
 END_TEST
 
+/* Records the order in which the windings are unwound. */
+static size_t with_deep_order[100];
+static size_t with_deep_len = 0;
+
+static void
+with_deep_unwind(size_t *i)
+{
+    with_deep_order[with_deep_len++] = *i;
+}
+
+static void
+with_deep(size_t depth, size_t max, int nested_try)
+{
+    size_t i = depth, *ip = &i;
+
+    if (depth == max) ec_throw_str_static(ECX_EC, "Deep.");
+
+    ec_with(ip, (void (*)(void *))with_deep_unwind) {
+        if (nested_try && depth == max / 2) {
+            /* Unwinding stops at the inner try (it catches). */
+            ec_try {
+                with_deep(depth + 1, max, 0);
+            }
+            ec_catch {
+                fail_unless(with_deep_len == max - depth - 1, NULL);
+                ec_rethrow;
+            }
+        }
+        else {
+            with_deep(depth + 1, max, nested_try);
+        }
+    }
+}
+
+START_TEST(with_nested_deep)
+{
+    /* Enough windings to grow a winding array a few times. */
+    with_deep_len = 0;
+    ec_try {
+        with_deep(0, 100, 1);
+    }
+    ec_catch { }
+
+    fail_unless(with_deep_len == 100, NULL);
+    for (size_t i = 0; i < 100; i++) {
+        fail_unless(with_deep_order[i] == 99 - i, NULL);
+    }
+
+    /* Nothing is left wound. */
+    with_deep_len = 0;
+    ec_try {
+        ec_throw_str_static(ECX_EC, "Shallow.");
+    }
+    ec_catch { }
+    fail_unless(with_deep_len == 0, NULL);
+}
+END_TEST
+
+START_TEST(with_kind_free)
+{
+    char *p = NULL;
+
+    ec_try {
+        ec_with_free(p) {
+            p = malloc(16);
+            fail_unless(p != NULL, NULL);
+            ec_throw_str_static(ECX_EC, "Free p.");
+        }
+    }
+    ec_catch { }
+
+    /* NULL is fine too. */
+    p = NULL;
+    ec_with_free(p) { }
+}
+END_TEST
+
+START_TEST(with_kind_fd)
+{
+    int fds[2];
+    fail_unless(pipe(fds) == 0, NULL);
+
+    /* The value when unwound is used. */
+    int fd = -1;
+    ec_try {
+        ec_with_fd(fd) {
+            fd = fds[0];
+            ec_throw_str_static(ECX_EC, "Close fd.");
+        }
+    }
+    ec_catch { }
+    fail_unless(fcntl(fds[0], F_GETFD) == -1 && errno == EBADF, NULL);
+
+    ec_with_fd(fds[1]) { }
+    fail_unless(fcntl(fds[1], F_GETFD) == -1 && errno == EBADF, NULL);
+
+    /* Negative descriptors are skipped. */
+    fd = -1;
+    ec_with_fd(fd) { }
+}
+END_TEST
+
+START_TEST(with_kind_file)
+{
+    FILE *f = NULL;
+    int fd = -1;
+
+    ec_with_file(f) {
+        f = fopen("/dev/null", "r");
+        fail_unless(f != NULL, NULL);
+        fd = fileno(f);
+    }
+    fail_unless(fcntl(fd, F_GETFD) == -1 && errno == EBADF, NULL);
+
+    f = NULL;
+    ec_with_file(f) { }
+}
+END_TEST
+
+START_TEST(with_kind_mutex)
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+
+    ec_try {
+        pthread_mutex_lock(&m);
+        ec_with_mutex(&m) {
+            ec_throw_str_static(ECX_EC, "Unlock m.");
+        }
+    }
+    ec_catch { }
+    fail_unless(pthread_mutex_trylock(&m) == 0, NULL);
+
+    ec_with_mutex(&m) { }
+    fail_unless(pthread_mutex_trylock(&m) == 0, NULL);
+    pthread_mutex_unlock(&m);
+}
+END_TEST
+
+START_TEST(with_kind_munmap)
+{
+    size_t length = (size_t)sysconf(_SC_PAGESIZE);
+    void *p = MAP_FAILED;
+
+    ec_try {
+        ec_with_munmap(p, length) {
+            p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            fail_unless(p != MAP_FAILED, NULL);
+            ec_throw_str_static(ECX_EC, "Unmap p.");
+        }
+    }
+    ec_catch { }
+    fail_unless(msync(p, length, MS_ASYNC) == -1 && errno == ENOMEM, NULL);
+
+    p = MAP_FAILED;
+    ec_with_munmap(p, length) { }
+}
+END_TEST
+
+START_TEST(with_kind_mixed)
+{
+    /* Built-in kinds and calls unwind in order. */
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    int *free_me = malloc(sizeof(int));
+    fail_unless(free_me != NULL, NULL);
+
+    with_free_ok_called = 0;
+    ec_try {
+        pthread_mutex_lock(&m);
+        ec_with_mutex(&m) {
+            ec_with(free_me, with_free_ok) {
+                ec_throw_str_static(ECX_EC, "Mixed.");
+            }
+        }
+    }
+    ec_catch { }
+    fail_unless(with_free_ok_called == 1, NULL);
+    fail_unless(pthread_mutex_trylock(&m) == 0, NULL);
+    pthread_mutex_unlock(&m);
+}
+END_TEST
+
+static int scope_ids[EC_SCOPE_DEFERS + 1];
+static int scope_order[EC_SCOPE_DEFERS + 1];
+static size_t scope_len = 0;
+
+static void
+scope_record(int *id)
+{
+    scope_order[scope_len++] = *id;
+}
+
+START_TEST(scope_ok)
+{
+    scope_len = 0;
+    ec_scope {
+        for (int i = 0; i < 4; i++) {
+            scope_ids[i] = i;
+            if (i == 1) {
+                ec_defer_on_x(&scope_ids[i], scope_record);
+            }
+            else {
+                ec_defer(&scope_ids[i], scope_record);
+            }
+        }
+        fail_unless(scope_len == 0, NULL);
+    }
+
+    fail_unless(scope_len == 3, NULL);
+    fail_unless(scope_order[0] == 3, NULL);
+    fail_unless(scope_order[1] == 2, NULL);
+    fail_unless(scope_order[2] == 0, NULL);
+}
+END_TEST
+
+START_TEST(scope_x)
+{
+    scope_len = 0;
+    ec_try {
+        ec_scope {
+            for (int i = 0; i < 4; i++) {
+                scope_ids[i] = i;
+                if (i == 1) {
+                    ec_defer_on_x(&scope_ids[i], scope_record);
+                }
+                else {
+                    ec_defer(&scope_ids[i], scope_record);
+                }
+            }
+            ec_throw_str_static(ECX_EC, "Scope.");
+        }
+    }
+    ec_catch { }
+
+    fail_unless(scope_len == 4, NULL);
+    for (size_t i = 0; i < 4; i++) {
+        fail_unless(scope_order[i] == 3 - (int)i, NULL);
+    }
+}
+END_TEST
+
+START_TEST(scope_overflow)
+{
+    const char *e = NULL;
+
+    scope_len = 0;
+    ec_try {
+        ec_scope {
+            for (int i = 0; i < EC_SCOPE_DEFERS + 1; i++) {
+                scope_ids[i] = i;
+                ec_defer(&scope_ids[i], scope_record);
+            }
+            fail("The scope should be full.");
+        }
+    }
+    ec_catch_a(ECX_ENOBUFS, e) {
+        (void)e;
+    }
+    ec_catch {
+        fail("Wrong exception type.");
+    }
+
+    /* The one that didn't fit is called first. */
+    fail_unless(scope_len == EC_SCOPE_DEFERS + 1, NULL);
+    for (size_t i = 0; i < EC_SCOPE_DEFERS + 1; i++) {
+        fail_unless(scope_order[i] == EC_SCOPE_DEFERS - (int)i, NULL);
+    }
+}
+END_TEST
+
+START_TEST(scope_nested)
+{
+    /* Scopes and windings unwind in order. */
+    int *free_me = malloc(sizeof(int));
+    fail_unless(free_me != NULL, NULL);
+
+    scope_len = 0;
+    with_free_ok_called = 0;
+    ec_try {
+        ec_scope {
+            scope_ids[0] = 0;
+            ec_defer(&scope_ids[0], scope_record);
+            ec_with(free_me, with_free_ok) {
+                ec_scope {
+                    scope_ids[1] = 1;
+                    ec_defer(&scope_ids[1], scope_record);
+                    ec_throw_str_static(ECX_EC, "Nested.");
+                }
+            }
+        }
+    }
+    ec_catch { }
+
+    fail_unless(with_free_ok_called == 1, NULL);
+    fail_unless(scope_len == 2, NULL);
+    fail_unless(scope_order[0] == 1, NULL);
+    fail_unless(scope_order[1] == 0, NULL);
+}
+END_TEST
+
+static void
+scope_record_throw(int *id)
+{
+    scope_record(id);
+    ec_throw_str_static(ECX_EC, "Cleanup.");
+}
+
+START_TEST(scope_cleanup_thrown)
+{
+    /* A throwing cleanup doesn't skip the others. */
+    scope_len = 0;
+    ec_try {
+        ec_scope {
+            for (int i = 0; i < 4; i++) {
+                scope_ids[i] = i;
+                if (i == 2) {
+                    ec_defer(&scope_ids[i], scope_record_throw);
+                }
+                else {
+                    ec_defer(&scope_ids[i], scope_record);
+                }
+            }
+        }
+        fail("The cleanup should have thrown.");
+    }
+    ec_catch { }
+
+    fail_unless(scope_len == 4, NULL);
+    for (size_t i = 0; i < 4; i++) {
+        fail_unless(scope_order[i] == 3 - (int)i, NULL);
+    }
+}
+END_TEST
+
+START_TEST(scope_cleanup_thrown_on_x)
+{
+    /* Once a cleanup throws on a normal exit, the scope is exiting by an
+     * exception and those deferred with ec_defer_on_x(...) are called too.
+     */
+    scope_len = 0;
+    ec_try {
+        ec_scope {
+            scope_ids[0] = 0;
+            ec_defer_on_x(&scope_ids[0], scope_record);
+            scope_ids[1] = 1;
+            ec_defer(&scope_ids[1], scope_record_throw);
+            scope_ids[2] = 2;
+            ec_defer_on_x(&scope_ids[2], scope_record);
+        }
+    }
+    ec_catch { }
+
+    fail_unless(scope_len == 2, NULL);
+    fail_unless(scope_order[0] == 1, NULL);
+    fail_unless(scope_order[1] == 0, NULL);
+}
+END_TEST
+
+START_TEST(scope_cleanup_thrown_x)
+{
+    /* The cleanup's exception replaces the one the scope exited by. */
+    const char *e = NULL;
+
+    scope_len = 0;
+    ec_try {
+        ec_scope {
+            for (int i = 0; i < 3; i++) {
+                scope_ids[i] = i;
+                if (i == 1) {
+                    ec_defer(&scope_ids[i], scope_record_throw);
+                }
+                else {
+                    ec_defer(&scope_ids[i], scope_record);
+                }
+            }
+            ec_throw_str_static(ECX_ENOBUFS, "Scope.");
+        }
+    }
+    ec_catch_a(ECX_ENOBUFS, e) {
+        (void)e;
+        fail("The cleanup's exception should replace the scope's.");
+    }
+    ec_catch { }
+
+    fail_unless(scope_len == 3, NULL);
+    for (size_t i = 0; i < 3; i++) {
+        fail_unless(scope_order[i] == 2 - (int)i, NULL);
+    }
+}
+END_TEST
+
 Suite *
 with_suite(void)
 {
@@ -224,6 +645,7 @@ with_suite(void)
     TCase *tc_with = tcase_create("basic with");
     tcase_add_test(tc_with, with_ok);
     tcase_add_test(tc_with, with_ok_thrown);
+    tcase_add_test(tc_with, with_library_thrown);
     tcase_add_test(tc_with, with_x);
     tcase_add_test(tc_with, with_x_thrown);
     tcase_add_test(tc_with, with_on_x_ok);
@@ -233,8 +655,28 @@ with_suite(void)
     TCase *tc_with_nested = tcase_create("nested with");
     tcase_add_test(tc_with_nested, with_nested_3);
     tcase_add_test(tc_with_nested, with_nested_3_alt);
+    tcase_add_test(tc_with_nested, with_nested_deep);
     suite_add_tcase(s, tc_with_nested);
 
+    TCase *tc_with_kind = tcase_create("typed with");
+    tcase_add_test(tc_with_kind, with_kind_free);
+    tcase_add_test(tc_with_kind, with_kind_fd);
+    tcase_add_test(tc_with_kind, with_kind_file);
+    tcase_add_test(tc_with_kind, with_kind_mutex);
+    tcase_add_test(tc_with_kind, with_kind_munmap);
+    tcase_add_test(tc_with_kind, with_kind_mixed);
+    suite_add_tcase(s, tc_with_kind);
+
+    TCase *tc_scope = tcase_create("scope");
+    tcase_add_test(tc_scope, scope_ok);
+    tcase_add_test(tc_scope, scope_x);
+    tcase_add_test(tc_scope, scope_overflow);
+    tcase_add_test(tc_scope, scope_nested);
+    tcase_add_test(tc_scope, scope_cleanup_thrown);
+    tcase_add_test(tc_scope, scope_cleanup_thrown_on_x);
+    tcase_add_test(tc_scope, scope_cleanup_thrown_x);
+    suite_add_tcase(s, tc_scope);
+
     return s;
 }
 
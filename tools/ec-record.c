@@ -0,0 +1,160 @@
+/* Copyright 2011 Caleb Case
+ *
+ * This file is part of the EC Library.
+ *
+ * The EC Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * The EC Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the EC Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ec/ec.h>
+
+/* Prints the records of flight recorder files (see ec_recorder_start(...)),
+ * oldest first, in the format of ec_fprint(...) with the time and thread in
+ * front:
+ *
+ * 2026-10-16T09:30:00.123456789Z 4242 src/io.c:80: read_all: Exception(EIO) Short read. (errno 5)
+ *
+ * Records which were being written when the process stopped are reported as
+ * incomplete.
+ */
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s FILE...\n", name);
+}
+
+/* Prints a string field (which may lack its terminator if the file is
+ * damaged).
+ */
+static void
+field(const char *s, size_t size)
+{
+    printf("%.*s", (int)strnlen(s, size), s);
+}
+
+static void
+print_record(const struct ec_record *record)
+{
+    time_t seconds = (time_t)(record->time / 1000000000);
+    struct tm tm;
+    char when[32] = "?";
+
+    if (gmtime_r(&seconds, &tm) != NULL) {
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    }
+
+    printf("%s.%09" PRIu64 "Z %" PRIu32 " ",
+            when, record->time % 1000000000, record->tid);
+
+    field(record->file, sizeof(record->file));
+    printf(":%" PRIu32 ": ", record->line);
+    field(record->function, sizeof(record->function));
+    printf(": Exception(");
+    field(record->type, sizeof(record->type));
+    printf(")");
+
+    if (record->data[0] != '\0') {
+        printf(" ");
+        field(record->data, sizeof(record->data));
+    }
+
+    if (record->errnum != 0) {
+        printf(" (errno %" PRId32 ")", record->errnum);
+    }
+
+    printf("\n");
+}
+
+/* Prints the records of the file at path. Returns 0 on success. */
+static int
+decode(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    struct ec_recorder_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, EC_RECORDER_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(struct ec_record) ||
+        header.records == 0) {
+        fprintf(stderr, "%s: Not a recorder file.\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    struct ec_record *records = calloc(header.records, sizeof(*records));
+    if (records == NULL ||
+        fread(records, sizeof(*records), header.records, file) != header.records) {
+        fprintf(stderr, "%s: Truncated recorder file.\n", path);
+        free(records);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+
+    uint64_t first = 0;
+    if (header.next > header.records) first = header.next - header.records;
+
+    printf("# %s: pid %" PRIu32 " thread %" PRIu32 ", %" PRIu64 " records",
+            path, header.pid, header.tid, header.next);
+    if (first > 0) printf(" (%" PRIu64 " overwritten)", first);
+    printf("\n");
+
+    for (uint64_t seq = first; seq < header.next; seq++) {
+        const struct ec_record *record = &records[seq % header.records];
+
+        if (record->seq != seq + 1) {
+            printf("# record %" PRIu64 " incomplete\n", seq);
+            continue;
+        }
+
+        print_record(record);
+    }
+
+    /* The thread may have stopped while writing the next record. */
+    const struct ec_record *last = &records[header.next % header.records];
+    if (last->seq == 0 && last->time != 0) {
+        printf("# record %" PRIu64 " incomplete\n", header.next);
+    }
+
+    free(records);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        usage(argv[0]);
+        return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = 1; i < argc; i++) {
+        if (decode(argv[i]) != 0) status = EXIT_FAILURE;
+    }
+
+    return status;
+}